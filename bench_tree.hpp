@@ -0,0 +1,88 @@
+/*
+Compile time tree generator shared by the benchmarks.
+Copyright (C) 2023  Dustin Sanford
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+Generates trees of a configurable number of leaves, fan out and leaf
+value types at compile time. Include after rapid_snippit.cpp.
+* bench_tree_t< Leaves, Fanout, Types > nests Leaves leaves with at most
+  Fanout children per internal node
+* bench_tree_wd< Width, Depth, Types > is the complete tree of Width^Depth
+  leaves, Depth levels of internal nodes below the root
+Leaf I is named lIIII and holds the (I % size)-th type of the tuple Types.
+*/
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+// the leaf value types used by Bar
+using bench_default_types = std::tuple<int, float, double, long>;
+
+// four decimal digits of I packed into a single mpl::string character group
+template< std::size_t I >
+using bench_digits = mpl::int_<
+	(('0' + I / 1000 % 10) << 24) | (('0' + I / 100 % 10) << 16) |
+	(('0' + I / 10 % 10) << 8) | ('0' + I % 10) >;
+
+// leaf I rotates through the value types of Types
+template< std::size_t I, typename Types >
+using bench_leaf = LeafNode<
+	mpl::string< 'l', bench_digits<I>::value >,
+	typename std::tuple_element< I % std::tuple_size<Types>::value, Types >::type >;
+
+// a tree holding the N leaves [Lo, Lo + N)
+template< std::size_t Lo, std::size_t N, std::size_t Fanout, typename Types, typename = void >
+struct bench_tree;
+
+// one level of leaves
+template< std::size_t Lo, std::size_t N, typename Types, std::size_t... Is >
+InternalNode< mpl::string< 't', bench_digits<Lo>::value >, bench_leaf<Lo + Is, Types>... >
+	bench_leaves(std::index_sequence<Is...>);
+
+// Fanout subtrees, each holding an equal share of the leaves
+template< std::size_t Lo, std::size_t N, std::size_t Fanout, typename Types, std::size_t... Is >
+InternalNode< mpl::string< 't', bench_digits<Lo>::value >,
+	typename bench_tree< Lo + Is * ((N + Fanout - 1) / Fanout),
+		std::min(N - Is * ((N + Fanout - 1) / Fanout), (N + Fanout - 1) / Fanout),
+		Fanout, Types >::type... >
+	bench_subtrees(std::index_sequence<Is...>);
+
+template< std::size_t Lo, std::size_t N, std::size_t Fanout, typename Types >
+struct bench_tree< Lo, N, Fanout, Types, typename std::enable_if< (N <= Fanout) >::type >
+{
+	using type = decltype(bench_leaves<Lo, N, Types>(std::make_index_sequence<N>{}));
+};
+
+template< std::size_t Lo, std::size_t N, std::size_t Fanout, typename Types >
+struct bench_tree< Lo, N, Fanout, Types, typename std::enable_if< (N > Fanout) >::type >
+{
+	using type = decltype(bench_subtrees<Lo, N, Fanout, Types>(std::make_index_sequence<
+		(N + (N + Fanout - 1) / Fanout - 1) / ((N + Fanout - 1) / Fanout) >{}));
+};
+
+template< std::size_t Leaves, std::size_t Fanout = 10, typename Types = bench_default_types >
+using bench_tree_t = typename bench_tree< 0, Leaves, Fanout, Types >::type;
+
+constexpr std::size_t bench_pow(std::size_t b, std::size_t e)
+{
+	return e ? b * bench_pow(b, e - 1) : 1;
+}
+
+template< std::size_t Width, std::size_t Depth, typename Types = bench_default_types >
+using bench_tree_wd = bench_tree_t< bench_pow(Width, Depth), Width, Types >;
@@ -0,0 +1,69 @@
+/*
+Compile time benchmark for the inher_tree_scan engines.
+Copyright (C) 2023  Dustin Sanford
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+Generates a tree with RAPID_COMPILE_BENCH_LEAVES leaves (nested with a
+fan out of RAPID_COMPILE_BENCH_FANOUT children per internal node) and
+instantiates +=, rand_gen and a sum for it. Compile once with and once
+without -DRAPID_FOLD_SCAN to compare the two scan engines, and with
+-DRAPID_COMPILE_BENCH_TABLE to run the same operations as table scans,
+see compile_bench.sh.
+*/
+
+#define RAPID_NO_MAIN
+#include "rapid_snippit.cpp"
+
+#include "bench_tree.hpp"
+
+#include <cstdio>
+
+#if !defined(RAPID_COMPILE_BENCH_LEAVES)
+#define RAPID_COMPILE_BENCH_LEAVES 10
+#endif
+
+#if !defined(RAPID_COMPILE_BENCH_FANOUT)
+#define RAPID_COMPILE_BENCH_FANOUT 10
+#endif
+
+using BenchTree = bench_tree_t< RAPID_COMPILE_BENCH_LEAVES, RAPID_COMPILE_BENCH_FANOUT >;
+
+int main()
+{
+	BenchTree a, b;
+
+	std::mt19937 gen{ 42 };
+#if defined(RAPID_COMPILE_BENCH_TABLE)
+	table_rand_gen(a, gen);
+	table_rand_gen(b, gen);
+
+	table_add_eq(a, b);
+
+	const double sum = table_sum(a);
+#else
+	a.rand_gen(gen);
+	b.rand_gen(gen);
+
+	a += b;
+
+	const double sum = tree_sum(a);
+#endif
+	std::printf("%g\n", sum);
+
+	return 0;
+}
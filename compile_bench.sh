@@ -0,0 +1,36 @@
+#!/bin/sh
+# Compares the recursive and the fold expression scan engines, and the
+# type erased table scans, on generated trees of 10, 100 and 1000 leaves:
+# compile time, object size, text size of the linked binary and the
+# wall time of one cold run of it.
+# usage: ./compile_bench.sh [leaf counts...]
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+[ $# -eq 0 ] && set -- 10 100 1000
+
+now() { date +%s.%N; }
+
+printf "%-8s %-8s %10s %12s %12s %10s\n" leaves engine seconds object_bytes text_bytes run_ms
+for n in "$@"; do
+	for engine in recur fold table; do
+		flags="-DRAPID_COMPILE_BENCH_LEAVES=$n"
+		[ "$engine" = fold ] && flags="$flags -DRAPID_FOLD_SCAN"
+		[ "$engine" = table ] && flags="$flags -DRAPID_COMPILE_BENCH_TABLE"
+		start=$(now)
+		$CXX $CXXFLAGS $flags -c "$(dirname "$0")/compile_bench.cpp" -o "$OUT/$engine.o" || exit 1
+		end=$(now)
+		$CXX $CXXFLAGS "$OUT/$engine.o" -o "$OUT/$engine" -lpthread || exit 1
+		sync
+		run_start=$(now)
+		"$OUT/$engine" > /dev/null || exit 1
+		run_end=$(now)
+		printf "%-8s %-8s %10.2f %12s %12s %10.2f\n" "$n" "$engine" \
+			"$(awk "BEGIN { print $end - $start }")" "$(wc -c < "$OUT/$engine.o")" \
+			"$(size "$OUT/$engine" | awk 'NR == 2 { print $1 }')" \
+			"$(awk "BEGIN { print ($run_end - $run_start) * 1000 }")"
+	done
+done
@@ -49,8 +49,55 @@ are inlined by the compiler and there are no virtual function
 table lookups (i.e. no runtime polymorphism).
 */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Relies on the boost mpl library and mpl dependencies within boost.
 // Solely header only libraries are used. The boost library can be found 
@@ -69,6 +116,10 @@ namespace mpl = boost::mpl;
 template< typename Child, typename Parent >
 Child& get(Parent& p) { return p; }
 
+// Static cast a const Parent object into a const Child object
+template< typename Child, typename Parent >
+const Child& get(const Parent& p) { return p; }
+
 // ******************************************************************
 // A RECURSIVELY IMPLIMENTED SCAN FOR INHERITANCE TREES
 // ******************************************************************
@@ -107,7 +158,7 @@ void inher_tree_scan_recur(mpl::bool_<false>, Parent& p, Params&&... ps)
 // * fills in boiler plate for the initial inher_tree_scan_recur call
 // * hides recursive call implementation details
 template< typename Func, typename Parent, typename... Params >
-void inher_tree_scan(Parent& p, Params&&... ps)
+void inher_tree_recur_scan(Parent& p, Params&&... ps)
 {
 	// check if the Parent has at least one base class
 	using is_empty = typename mpl::empty<typename Parent::base_type>;
@@ -119,18 +170,443 @@ void inher_tree_scan(Parent& p, Params&&... ps)
 		(is_empty{}, p, std::forward<Params>(ps)...);
 }
 
+// ******************************************************************
+// A FOLD EXPRESSION BASED SCAN FOR INHERITANCE TREES
+// ******************************************************************
+
+// A minimal compile time list of types
+// Unlike mpl::vector it has no length limit and is expanded directly,
+// without O(N^2) pop_front/empty instantiations
+template< typename... Ts >
+struct type_list {};
+
+// expand the list of children with a single comma fold
+// evaluation order is left to right, i.e. identical to inher_tree_scan_recur
+template< typename Func, typename Parent, typename... Children, typename... Params >
+void inher_tree_fold_scan_impl(type_list< Children... >, Parent& p, Params&&... ps)
+{
+	(Func::template apply<Parent, Children>(p, std::forward<Params>(ps)...), ...);
+}
+
+// helper function for inher_tree_fold_scan_impl
+// * uses Parent::child_types, the type_list equivalent of Parent::base_type
+template< typename Func, typename Parent, typename... Params >
+void inher_tree_fold_scan(Parent& p, Params&&... ps)
+{
+	inher_tree_fold_scan_impl< Func >
+		(typename Parent::child_types{}, p, std::forward<Params>(ps)...);
+}
+
+// Defining RAPID_FOLD_SCAN swaps the recursive engine for the fold engine,
+// both call Func::apply<Parent, Child> in the same order
+template< typename Func, typename Parent, typename... Params >
+void inher_tree_engine_scan(Parent& p, Params&&... ps)
+{
+#if defined(RAPID_FOLD_SCAN)
+	inher_tree_fold_scan< Func >(p, std::forward<Params>(ps)...);
+#else
+	inher_tree_recur_scan< Func >(p, std::forward<Params>(ps)...);
+#endif
+}
+
+#if defined(RAPID_INSTRUMENT)
+template< typename Func >
+struct instrumented;
+
+// the nesting depth of instrumented<Func> calls on this thread
+template< typename Func >
+inline thread_local unsigned instrument_depth = 0;
+#endif
+
+// The scan used throughout the rest of this file
+// Within an instrumented<Func> call, RAPID_INSTRUMENT builds route the
+// scans Func makes below its internal children through instrumented<Func>
+// as well, see SCAN INSTRUMENTATION
+template< typename Func, typename Parent, typename... Params >
+void inher_tree_scan(Parent& p, Params&&... ps)
+{
+#if defined(RAPID_INSTRUMENT)
+	if (instrument_depth<Func>) {
+		inher_tree_engine_scan< instrumented<Func> >(p, std::forward<Params>(ps)...);
+		return;
+	}
+#endif
+	inher_tree_engine_scan< Func >(p, std::forward<Params>(ps)...);
+}
+
+// ******************************************************************
+// COMPILE TIME TREE TRAITS
+// ******************************************************************
+
+template<typename Name, typename... ChildNodes>
+struct InternalNode;
+
+template<typename Name, typename T>
+struct LeafNode;
+
+template< typename Op, typename... Args >
+struct tree_expr;
+
+// compile time check for leaf nodes
+template<typename Node>
+struct is_leaf : mpl::false_ {};
+
+template<typename Name, typename T>
+struct is_leaf< LeafNode<Name, T> > : mpl::true_ {};
+
+// compile time mean and standard deviation of the values drawn by rand_gen,
+// see leaf_kernel_rand_gen for the distribution of each kind of leaf
+// specialize for individual leaves to change their distribution
+template<typename Leaf>
+struct rand_gen_params
+{
+	static constexpr double mean = 100;
+	static constexpr double stddev = 50;
+};
+
+// how the += of a leaf combines two values
+// specialize leaf_add_policy for individual leaves to change it
+struct add_wrap {};     // plain +=
+struct add_saturate {}; // integers clamp to the range of T instead of overflowing
+
+template<typename Leaf>
+struct leaf_add_policy { using type = add_wrap; };
+
+// concatenate any number of type_lists
+template< typename... Lists >
+struct type_list_cat { using type = type_list<>; };
+
+template< typename... As >
+struct type_list_cat< type_list<As...> > { using type = type_list<As...>; };
+
+template< typename... As, typename... Bs, typename... Rest >
+struct type_list_cat< type_list<As...>, type_list<Bs...>, Rest... >
+	: type_list_cat< type_list<As..., Bs...>, Rest... > {};
+
+// the number of types in a type_list
+template< typename List >
+struct type_list_size;
+
+template< typename... Ts >
+struct type_list_size< type_list<Ts...> >
+	: std::integral_constant< std::size_t, sizeof...(Ts) > {};
+
+// the I-th type of a type_list
+template< std::size_t I, typename List >
+struct type_list_at;
+
+template< std::size_t I, typename... Ts >
+struct type_list_at< I, type_list<Ts...> >
+	: std::tuple_element< I, std::tuple<Ts...> > {};
+
+// position of T within a type_list
+template< typename T, typename... Ts >
+constexpr std::size_t type_list_index(type_list<Ts...>)
+{
+	std::size_t i = 0, found = sizeof...(Ts);
+	((found = (found == sizeof...(Ts) && std::is_same<T, Ts>::value) ? i : found, ++i), ...);
+	return found;
+}
+
+// Two trees are layout compatible when they have the same shape and
+// the same leaf value types, their names may differ
+template< typename A, typename B,
+	typename LeafA = typename is_leaf<A>::type, typename LeafB = typename is_leaf<B>::type >
+struct layout_compatible : mpl::false_ {};
+
+template< typename A, typename B >
+struct layout_compatible< A, B, mpl::true_, mpl::true_ >
+	: mpl::bool_< std::is_same< typename A::value_type, typename B::value_type >::value > {};
+
+template< typename As, typename Bs, bool = (type_list_size<As>::value == type_list_size<Bs>::value) >
+struct layout_compatible_children : mpl::false_ {};
+
+template< typename... As, typename... Bs >
+struct layout_compatible_children< type_list<As...>, type_list<Bs...>, true >
+	: mpl::bool_< (layout_compatible<As, Bs>::value && ...) > {};
+
+template< typename A, typename B >
+struct layout_compatible< A, B, mpl::false_, mpl::false_ >
+	: layout_compatible_children< typename A::child_types, typename B::child_types > {};
+
+// the child of Rhs in the same position as Child is within Parent
+template< typename Parent, typename Child, typename Rhs >
+struct matching_child
+	: type_list_at< type_list_index<Child>(typename Parent::child_types{}),
+		typename std::remove_const<Rhs>::type::child_types > {};
+
+// Static cast a layout compatible Rhs object into the child matching Child
+// lets functors scan two trees whose names differ
+template< typename Parent, typename Child, typename Rhs >
+decltype(auto) get_matching(Rhs& b)
+{
+	return get< typename matching_child<Parent, Child, Rhs>::type >(b);
+}
+
+// the same tree with every leaf value type T replaced by F<T>::type
+template< typename Node, template<typename> class F >
+struct rebind_leaves;
+
+template< typename Name, typename T, template<typename> class F >
+struct rebind_leaves< LeafNode<Name, T>, F >
+{
+	using type = LeafNode< Name, typename F<T>::type >;
+};
+
+template< typename Name, typename... ChildNodes, template<typename> class F >
+struct rebind_leaves< InternalNode<Name, ChildNodes...>, F >
+{
+	using type = InternalNode< Name, typename rebind_leaves<ChildNodes, F>::type... >;
+};
+
+// the leaves of a tree flattened into a type_list, in scan order
+template< typename Node, typename IsLeaf = typename is_leaf<Node>::type >
+struct tree_leaves { using type = type_list<Node>; };
+
+template< typename Node, typename... Children >
+struct tree_leaves_of;
+
+template< typename Node >
+struct tree_leaves< Node, mpl::false_ >
+	: tree_leaves_of< Node, typename Node::child_types > {};
+
+template< typename Node, typename... Children >
+struct tree_leaves_of< Node, type_list<Children...> >
+	: type_list_cat< typename tree_leaves<Children>::type... > {};
+
+// size of a node in the flat packed layout, i.e. the sum of the sizes of
+// all leaf values without any padding
+template< typename Node, typename IsLeaf = typename is_leaf<Node>::type >
+struct packed_size
+	: std::integral_constant< std::size_t, sizeof(typename Node::value_type) > {};
+
+template< typename Node, typename Children = typename Node::child_types >
+struct packed_size_of;
+
+template< typename Node >
+struct packed_size< Node, mpl::false_ > : packed_size_of< Node > {};
+
+template< typename Node, typename... Children >
+struct packed_size_of< Node, type_list<Children...> >
+	: std::integral_constant< std::size_t, (std::size_t(0) + ... + packed_size<Children>::value) > {};
+
+// offset of Child within the flat packed layout of Parent
+template< typename Child, typename... Children >
+constexpr std::size_t packed_offset_impl(type_list<Children...>)
+{
+	std::size_t offset = 0;
+	bool found = false;
+	((found = found || std::is_same<Child, Children>::value,
+		offset += found ? 0 : packed_size<Children>::value), ...);
+	return offset;
+}
+
+template< typename Parent, typename Child >
+struct packed_offset
+	: std::integral_constant< std::size_t,
+		packed_offset_impl<Child>(typename Parent::child_types{}) > {};
+
+// ******************************************************************
+// A TASK PARALLEL SCAN FOR INHERITANCE TREES
+// ******************************************************************
+
+// Compile time cost hint of visiting a node, in bytes of payload
+// The default is the object size, which is exact for plain leaves and
+// sums over the children of internal nodes. Leaves whose payload lives
+// outside the object (e.g. a std::vector) should specialize scan_cost.
+template< typename Node >
+struct scan_cost : std::integral_constant< std::size_t, sizeof(Node) > {};
+
+// children costing at least this much are given a task of their own
+constexpr std::size_t parallel_scan_grain = std::size_t(1) << 16;
+
+// tag selecting the parallel overload of inher_tree_scan
+struct parallel_scan_t {};
+constexpr parallel_scan_t par_scan{};
+
+// expensive child, spawn a task
+template< typename Func, typename Parent, typename Child, typename... Params >
+void par_scan_spawn(mpl::true_, std::vector< std::future<void> >& tasks,
+	Parent& p, Params&... ps)
+{
+	tasks.push_back(std::async(std::launch::async, [&p, &ps...] {
+		Func::template apply<Parent, Child>(p, ps...);
+	}));
+}
+
+template< typename Func, typename Parent, typename Child, typename... Params >
+void par_scan_spawn(mpl::false_, std::vector< std::future<void> >&, Parent&, Params&...) {}
+
+// cheap child, run it on the calling thread
+template< typename Func, typename Parent, typename Child, typename... Params >
+void par_scan_inline(mpl::false_, Parent& p, Params&... ps)
+{
+	Func::template apply<Parent, Child>(p, ps...);
+}
+
+template< typename Func, typename Parent, typename Child, typename... Params >
+void par_scan_inline(mpl::true_, Parent&, Params&...) {}
+
+template< typename Func, typename Parent, typename... Children, typename... Params >
+void inher_tree_par_scan_impl(type_list< Children... >, Parent& p, Params&... ps)
+{
+	std::vector< std::future<void> > tasks;
+
+	// first hand every expensive child to its own task
+	(par_scan_spawn< Func, Parent, Children >(
+		mpl::bool_< (scan_cost<Children>::value >= parallel_scan_grain) >{},
+		tasks, p, ps...), ...);
+
+	// then run all cheap children as a single batch on this thread
+	(par_scan_inline< Func, Parent, Children >(
+		mpl::bool_< (scan_cost<Children>::value >= parallel_scan_grain) >{},
+		p, ps...), ...);
+
+	// wait for (and rethrow from) the spawned children
+	for (auto& t : tasks) t.get();
+}
+
+// Parallel overload of inher_tree_scan: inher_tree_scan<Func>(par_scan, p, ...)
+// Sibling children run concurrently, so Func::apply must be safe to call
+// concurrently for different children with the same (shared) parameters.
+// The runtime parameters are passed to Func as lvalues.
+template< typename Func, typename Parent, typename... Params >
+void inher_tree_scan(parallel_scan_t, Parent& p, Params&&... ps)
+{
+	inher_tree_par_scan_impl< Func >(typename Parent::child_types{}, p, ps...);
+}
+
+// ******************************************************************
+// ALLOCATION FREE FORMATTING
+// ******************************************************************
+
+// number of characters packed into one mpl::string character group
+constexpr std::size_t mpl_char_count(unsigned int c)
+{
+	return c == 0 ? 0 : (c > 0xffffff) + (c > 0xffff) + (c > 0xff) + 1;
+}
+
+// The characters of an mpl::string name as a constexpr array
+// (not null terminated), i.e. a compile time mpl::c_str
+template< typename Name >
+struct static_name;
+
+template< int... Cs >
+struct static_name< mpl::string<Cs...> >
+{
+	static constexpr std::size_t size =
+		(std::size_t(0) + ... + mpl_char_count(static_cast<unsigned int>(Cs)));
+
+	static constexpr std::array<char, size> make()
+	{
+		std::array<char, size> chars{};
+		std::size_t i = 0;
+		for (unsigned int c : { static_cast<unsigned int>(Cs)... })
+			for (std::size_t n = mpl_char_count(c); n-- > 0; )
+				chars[i++] = static_cast<char>(0xff & (c >> (8 * n)));
+		return chars;
+	}
+
+	static constexpr std::array<char, size> value = make();
+};
+
+// concatenate constexpr character arrays
+template< std::size_t... Ns >
+constexpr std::array<char, (std::size_t(0) + ... + Ns)>
+	concat_chars(const std::array<char, Ns>&... parts)
+{
+	std::array<char, (std::size_t(0) + ... + Ns)> chars{};
+	std::size_t i = 0;
+	auto append = [&chars, &i](const auto& part) {
+		for (char c : part) chars[i++] = c;
+	};
+	(append(parts), ...);
+	return chars;
+}
+
+// The compile time label "N1 N2 ... Name == " of a leaf called Name
+// below the internal nodes named by the type_list Path
+template< typename Path, typename Name >
+struct path_label;
+
+template< typename... Path, typename Name >
+struct path_label< type_list<Path...>, Name >
+{
+	static constexpr std::array<char, 1> space{ { ' ' } };
+	static constexpr std::array<char, 4> equals{ { ' ', '=', '=', ' ' } };
+
+	static constexpr auto value = concat_chars(
+		concat_chars(static_name<Path>::value, space)...,
+		static_name<Name>::value, equals);
+};
+
+// leaf values which std::to_chars formats like operator<< does
+template< typename T >
+struct to_chars_formattable
+	: mpl::bool_< std::is_floating_point<T>::value ||
+		(std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+		 !std::is_same<T, char>::value && !std::is_same<T, signed char>::value &&
+		 !std::is_same<T, unsigned char>::value) > {};
+
+// the default (6 significant digit) std::ostream formatting of
+// floating point values
+template< typename T >
+std::to_chars_result to_chars_value(std::true_type, char* first, char* last, const T& val)
+{
+	return std::to_chars(first, last, val, std::chars_format::general, 6);
+}
+
+template< typename T >
+std::to_chars_result to_chars_value(std::false_type, char* first, char* last, const T& val)
+{
+	return std::to_chars(first, last, val);
+}
+
+// format an arithmetic value without allocating
+template< typename OutputIt, typename T >
+OutputIt format_value(mpl::true_, OutputIt out, const T& val)
+{
+	char buf[64];
+	std::to_chars_result r =
+		to_chars_value(std::is_floating_point<T>{}, buf, buf + sizeof(buf), val);
+	return std::copy(buf, r.ptr, out);
+}
+
+// any other value type falls back to operator<<
+template< typename OutputIt, typename T >
+OutputIt format_value(mpl::false_, OutputIt out, const T& val)
+{
+	std::ostringstream os;
+	os << val;
+	const std::string s = os.str();
+	return std::copy(s.begin(), s.end(), out);
+}
+
+// print a tree through a reusable buffer with a single write and flush
+// the buffer keeps its capacity, so repeated calls do not allocate
+template< typename Tree >
+void print_buffered(const Tree& t, std::string& buffer, std::string_view prefix = "",
+	std::ostream& os = std::cout)
+{
+	buffer.clear();
+	t.format_to(std::back_inserter(buffer), prefix);
+	os.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+	os.flush();
+}
+
 // ******************************************************************
 // GENERIC FUNCTOR TEMPLATES
 // ******************************************************************
 
 // a generic equality functor template
 // formatted to match the interface required by inher_tree_scan 
+// b may be any tree layout compatible with a and is only read
 struct add_eq
 {
-	template <typename Parent, typename Child>
-	static void apply(Parent& a, Parent& b)
+	template <typename Parent, typename Child, typename Rhs>
+	static void apply(Parent& a, const Rhs& b)
 	{
-		get<Child>(a) += get<Child>(b);
+		get<Child>(a) += get_matching<Parent, Child>(b);
 	}
 };
 
@@ -155,6 +631,271 @@ struct print_f
 	}
 };
 
+// a generic allocation free formatting functor template
+// Path is the compile time list of the names of all nodes above Child
+template <typename Path, typename OutputIt>
+struct format_to_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, OutputIt& out, std::string_view prefix) {
+		out = get<Child>(a).template format_path_to<Path>(out, prefix);
+	}
+};
+
+// a generic expression template evaluation functor template
+// assigns every leaf of Child the value of the expression at that leaf
+// * Parent is the current node of the tree being assigned
+// * proj maps a root Tree onto the current Child
+struct expr_assign_f
+{
+	template<typename Parent, typename Child, typename Expr, typename Proj>
+	static void apply(Parent& a, const Expr& e, Proj proj) {
+		auto child_proj = [proj](auto& t) -> decltype(auto) {
+			return get<Child>(proj(t));
+		};
+		apply_impl(is_leaf<Child>{}, get<Child>(a), e, child_proj);
+	}
+
+private:
+	template<typename Child, typename Expr, typename Proj>
+	static void apply_impl(mpl::true_, Child& c, const Expr& e, Proj proj) {
+		static_assert(std::is_same< typename leaf_add_policy<Child>::type, add_wrap >::value,
+			"tree expressions evaluate in plain arithmetic, they do not support saturating leaves");
+		c.val = static_cast<typename Child::value_type>(e.eval(proj));
+	}
+
+	template<typename Child, typename Expr, typename Proj>
+	static void apply_impl(mpl::false_, Child& c, const Expr& e, Proj proj) {
+		inher_tree_scan< expr_assign_f >(c, e, proj);
+	}
+};
+
+// a generic binary serialization functor template
+// writes Child into its compile time offset of the flat packed layout of Parent
+struct serialize_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, unsigned char* out) {
+		get<Child>(a).serialize(out + packed_offset<Parent, Child>::value);
+	}
+};
+
+// a generic binary deserialization functor template
+// reads Child from its compile time offset of the flat packed layout of Parent
+struct deserialize_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, const unsigned char* in) {
+		get<Child>(a).deserialize(in + packed_offset<Parent, Child>::value);
+	}
+};
+
+// ******************************************************************
+// TAG DISPATCHED LEAF KERNELS
+// ******************************************************************
+
+// Every leaf operation (add, rand_gen, serialize, reduce) is forwarded
+// to a kernel picked at compile time from the leaf value type, so that
+// e.g. integers never take a detour through floating point
+struct kernel_integral {};
+struct kernel_floating {};
+struct kernel_array {};   // std::array, handled element by element
+struct kernel_generic {}; // anything else, including bool
+
+template<typename T>
+struct is_std_array : std::false_type {};
+
+template<typename E, std::size_t N>
+struct is_std_array< std::array<E, N> > : std::true_type {};
+
+template<typename T>
+struct leaf_kernel_kind
+{
+	using type = typename std::conditional<
+		std::is_integral<T>::value && !std::is_same<T, bool>::value, kernel_integral,
+		typename std::conditional< std::is_floating_point<T>::value, kernel_floating,
+		typename std::conditional< is_std_array<T>::value, kernel_array,
+			kernel_generic >::type >::type >::type;
+};
+
+// Accumulator type of a leaf value type, widened so that reductions of
+// many values neither overflow nor lose precision needlessly
+// * signed / unsigned integers accumulate in 64 bits
+// * float accumulates in double
+// * std::array accumulates its elements
+template< typename T >
+struct reduce_accum
+{
+	using type = typename std::conditional< std::is_floating_point<T>::value,
+		typename std::conditional< (sizeof(T) < sizeof(double)), double, T >::type,
+		typename std::conditional< std::is_signed<T>::value,
+			std::int64_t, std::uint64_t >::type >::type;
+};
+
+template< typename E, std::size_t N >
+struct reduce_accum< std::array<E, N> > : reduce_accum<E> {};
+
+// add
+template<typename T, typename Policy, typename Kind>
+void leaf_kernel_add(T& a, const T& b, Policy, Kind) { a += b; }
+
+template<typename T>
+void leaf_kernel_add(T& a, const T& b, add_saturate, kernel_integral)
+{
+	using lim = std::numeric_limits<T>;
+	if (b > 0 && a > lim::max() - b) a = lim::max();
+	else if (b < 0 && a < lim::min() - b) a = lim::min();
+	else a = static_cast<T>(a + b);
+}
+
+template<typename E, std::size_t N, typename Policy>
+void leaf_kernel_add(std::array<E, N>& a, const std::array<E, N>& b, Policy p, kernel_array)
+{
+	for (std::size_t i = 0; i < N; ++i)
+		leaf_kernel_add(a[i], b[i], p, typename leaf_kernel_kind<E>::type{});
+}
+
+template<typename Leaf>
+void leaf_add_eq(typename Leaf::value_type& a, const typename Leaf::value_type& b)
+{
+	using T = typename Leaf::value_type;
+	leaf_kernel_add(a, b, typename leaf_add_policy<Leaf>::type{},
+		typename leaf_kernel_kind<T>::type{});
+}
+
+// rand_gen, drawing with the given mean and standard deviation
+// * floating point samples the normal distribution directly in T
+// * integers sample a uniform integer distribution with the same mean
+//   and standard deviation, clamped to the range of T
+// * anything else static casts a double normal sample
+template<typename T, typename Generator>
+void leaf_kernel_rand_gen(T& v, Generator& gen, double mean, double stddev, kernel_generic)
+{
+	std::normal_distribution<> dist{ mean, stddev };
+	v = static_cast<T>(dist(gen));
+}
+
+template<typename T, typename Generator>
+void leaf_kernel_rand_gen(T& v, Generator& gen, double mean, double stddev, kernel_floating)
+{
+	std::normal_distribution<T> dist{ T(mean), T(stddev) };
+	v = dist(gen);
+}
+
+// the bounds [lo, hi] of the uniform integer distribution of T with the
+// given mean and standard deviation, clamped to the range of T
+// (long long wide, uniform_int_distribution is only defined for short and wider)
+template<typename T>
+auto rand_int_bounds(double mean, double stddev)
+{
+	using W = typename std::conditional< std::is_signed<T>::value, long long, unsigned long long >::type;
+	using lim = std::numeric_limits<T>;
+	const double half = std::sqrt(3.0) * stddev;
+	const double lo = std::ceil(mean - half);
+	const double hi = std::floor(mean + half);
+	const W wlo = lo <= double(lim::min()) ? W(lim::min()) : lo >= double(lim::max()) ? W(lim::max()) : W(lo);
+	const W whi = hi >= double(lim::max()) ? W(lim::max()) : hi <= double(lim::min()) ? W(lim::min()) : W(hi);
+	return std::pair<W, W>{ wlo, std::max(wlo, whi) };
+}
+
+template<typename T, typename Generator>
+void leaf_kernel_rand_gen(T& v, Generator& gen, double mean, double stddev, kernel_integral)
+{
+	const auto bounds = rand_int_bounds<T>(mean, stddev);
+	std::uniform_int_distribution<typename decltype(bounds)::first_type> dist{ bounds.first, bounds.second };
+	v = static_cast<T>(dist(gen));
+}
+
+template<typename E, std::size_t N, typename Generator>
+void leaf_kernel_rand_gen(std::array<E, N>& v, Generator& gen, double mean, double stddev, kernel_array)
+{
+	for (auto& e : v)
+		leaf_kernel_rand_gen(e, gen, mean, stddev, typename leaf_kernel_kind<E>::type{});
+}
+
+// rand_gen with the rand_gen_params of Leaf
+template<typename Leaf, typename Generator>
+void leaf_rand_gen(typename Leaf::value_type& v, Generator& gen)
+{
+	leaf_kernel_rand_gen(v, gen, rand_gen_params<Leaf>::mean, rand_gen_params<Leaf>::stddev,
+		typename leaf_kernel_kind<typename Leaf::value_type>::type{});
+}
+
+// serialize, every trivially copyable kind (std::array included) is a
+// single memcpy of the value
+template<typename T>
+void leaf_store(unsigned char* out, const T& v)
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+		"packed serialization requires trivially copyable leaf values");
+	std::memcpy(out, &v, sizeof(T));
+}
+
+template<typename T>
+void leaf_load(T& v, const unsigned char* in)
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+		"packed serialization requires trivially copyable leaf values");
+	std::memcpy(&v, in, sizeof(T));
+}
+
+// equality of a single leaf value, bitwise for trivially copyable values
+// (so -0.0 != 0.0 and a NaN equals itself), consistent with hash_value
+template< typename T >
+bool leaf_equal(const T& a, const T& b)
+{
+	if constexpr (std::is_trivially_copyable<T>::value)
+		return std::memcmp(&a, &b, sizeof(T)) == 0;
+	else
+		return a == b;
+}
+
+// reduction ops, Op::apply(acc, w) folds one widened value into acc
+struct reduce_sum { template< typename A, typename W > static void apply(A& acc, W v) { acc += v; } };
+struct reduce_min { template< typename A, typename W > static void apply(A& acc, W v) { if (v < acc) acc = A(v); } };
+struct reduce_max { template< typename A, typename W > static void apply(A& acc, W v) { if (v > acc) acc = A(v); } };
+
+// reduce, Op::apply(acc, w) with every value widened to reduce_accum
+template<typename Op, typename Acc, typename T, typename Kind>
+void leaf_kernel_reduce(Acc& acc, const T& v, Kind)
+{
+	Op::apply(acc, static_cast<typename reduce_accum<T>::type>(v));
+}
+
+template<typename Op, typename Acc, typename E, std::size_t N>
+void leaf_kernel_reduce(Acc& acc, const std::array<E, N>& v, kernel_array)
+{
+	for (const auto& e : v)
+		leaf_kernel_reduce<Op>(acc, e, typename leaf_kernel_kind<E>::type{});
+}
+
+template<typename Op, typename Acc, typename T>
+void leaf_reduce(Acc& acc, const T& v)
+{
+	leaf_kernel_reduce<Op>(acc, v, typename leaf_kernel_kind<T>::type{});
+}
+
+// dot, acc += a * b with both values widened to reduce_accum first
+template<typename T, typename Kind>
+void leaf_kernel_dot(double& acc, const T& a, const T& b, Kind)
+{
+	using W = typename reduce_accum<T>::type;
+	acc += static_cast<double>(static_cast<W>(a) * static_cast<W>(b));
+}
+
+template<typename E, std::size_t N>
+void leaf_kernel_dot(double& acc, const std::array<E, N>& a, const std::array<E, N>& b, kernel_array)
+{
+	for (std::size_t i = 0; i < N; ++i)
+		leaf_kernel_dot(acc, a[i], b[i], typename leaf_kernel_kind<E>::type{});
+}
+
+template<typename T>
+void leaf_dot(double& acc, const T& a, const T& b)
+{
+	leaf_kernel_dot(acc, a, b, typename leaf_kernel_kind<T>::type{});
+}
+
 // ******************************************************************
 // EXAMPLE INTERNAL NODE FOR INHERITANCE TREES
 // ******************************************************************
@@ -171,15 +912,33 @@ struct InternalNode
 
 	// compile time equivalent of a list of pointers to child nodes
 	using base_type = mpl::vector< ChildNodes... >;
+	using child_types = type_list< ChildNodes... >;
 
 	// perform addition by adding child nodes together
-	template <typename RhsName>
-	InternalNode& operator+=( InternalNode<RhsName, ChildNodes...>& rhs)
+	// rhs may be const, a temporary, or any layout compatible tree
+	template <typename Rhs, typename = typename std::enable_if<
+		layout_compatible<InternalNode, Rhs>::value >::type>
+	InternalNode& operator+=(const Rhs& rhs)
 	{
 		inher_tree_scan< add_eq >(*this, rhs);
 		return *this;
 	}
 
+	// evaluate an expression template, e.g. a = b + c * d, in a single
+	// pass over the leaves without any temporary trees
+	template <typename Op, typename... Args>
+	InternalNode& operator=(const tree_expr<Op, Args...>& e)
+	{
+		auto root = [](auto& t) -> decltype(auto) { return t; };
+		inher_tree_scan< expr_assign_f >(*this, e, root);
+		return *this;
+	}
+
+	// leaf by leaf value equality (0.0 == -0.0, NaN != NaN), see
+	// tree_value_equal; tree_equal is the bitwise form used for hashing
+	bool operator==(const InternalNode& rhs) const { return tree_value_equal(*this, rhs); }
+	bool operator!=(const InternalNode& rhs) const { return !(*this == rhs); }
+
 	// a simplistic print function 
 	void print(std::string prefix = "") {
 		// if not the first level then add a space
@@ -190,6 +949,20 @@ struct InternalNode
 		inher_tree_scan< print_f >(*this, prefix);
 	}
 
+	// write print() formatted output into out, without allocating
+	// the "name name ... == " labels are compile time constants
+	template<typename OutputIt>
+	OutputIt format_to(OutputIt out, std::string_view prefix = "") const {
+		return format_path_to< type_list<> >(out, prefix);
+	}
+
+	template<typename Path, typename OutputIt>
+	OutputIt format_path_to(OutputIt out, std::string_view prefix) const {
+		using path = typename type_list_cat< Path, type_list<name> >::type;
+		inher_tree_scan< format_to_f<path, OutputIt> >(*this, out, prefix);
+		return out;
+	}
+
 	// a simplistic random initializer
 	template<typename Generator>
 	void rand_gen(Generator& g)
@@ -197,6 +970,16 @@ struct InternalNode
 		// initialize all child nodes
 		inher_tree_scan< rand_gen_f<Generator> >(*this, g);
 	}
+
+	// write all child nodes into the flat packed layout starting at out
+	void serialize(unsigned char* out) const {
+		inher_tree_scan< serialize_f >(*this, out);
+	}
+
+	// read all child nodes from the flat packed layout starting at in
+	void deserialize(const unsigned char* in) {
+		inher_tree_scan< deserialize_f >(*this, in);
+	}
 };
 
 // ******************************************************************
@@ -208,36 +991,5117 @@ template<typename Name, typename T>
 struct LeafNode
 {
 	using name = Name;
+	using value_type = T;
 
 	LeafNode() : val() {}
 
-	LeafNode& operator+=(LeafNode& rhs) {
-		this->val += rhs.val;
+	template <typename RhsName>
+	LeafNode& operator+=(const LeafNode<RhsName, T>& rhs) {
+		leaf_add_eq<LeafNode>(val, rhs.val);
 		return *this;
 	}
 
+	bool operator==(const LeafNode& rhs) const { return val == rhs.val; }
+	bool operator!=(const LeafNode& rhs) const { return !(*this == rhs); }
+
 	// print the leaf node value
 	void print(std::string prefix = "") {
 		if (prefix != "") prefix += " ";
 		std::cout << prefix << mpl::c_str<name>::value << " == " << val << std::endl;
 	}
 
-	// assign the leaf node a random value 
-	// different data types are simplistically handled with a static cast
-	// normally, tag dispatch would be used to hand different data types
-	template< typename Generator >
+	// write print() formatted output into out, without allocating
+	template<typename OutputIt>
+	OutputIt format_to(OutputIt out, std::string_view prefix = "") const {
+		return format_path_to< type_list<> >(out, prefix);
+	}
+
+	template<typename Path, typename OutputIt>
+	OutputIt format_path_to(OutputIt out, std::string_view prefix) const {
+		constexpr auto& label = path_label<Path, name>::value;
+		if (!prefix.empty()) {
+			out = std::copy(prefix.begin(), prefix.end(), out);
+			*out++ = ' ';
+		}
+		out = std::copy(label.begin(), label.end(), out);
+		out = format_value(to_chars_formattable<T>{}, out, val);
+		*out++ = '\n';
+		return out;
+	}
+
+	// assign the leaf node a random value 
+	// the distribution is tag dispatched on T, see leaf_kernel_kind
+	template< typename Generator >
 	void rand_gen(Generator& gen) {
-		std::normal_distribution<> dist {100, 50};
-		val = static_cast<T>(dist(gen));
+		leaf_rand_gen<LeafNode>(val, gen);
+	}
+
+	// copy the leaf value to and from the flat packed layout
+	void serialize(unsigned char* out) const { leaf_store(out, val); }
+
+	void deserialize(const unsigned char* in) { leaf_load(val, in); }
+
+	T val;
+};
+
+// ******************************************************************
+// COMPILE TIME PATH LOOKUP
+// ******************************************************************
+
+// compile time comparison of a constexpr name with a character array
+template< std::size_t N >
+constexpr bool chars_equal(const std::array<char, N>& a, const char* b, std::size_t size)
+{
+	if (N != size) return false;
+	for (std::size_t i = 0; i < N; ++i)
+		if (a[i] != b[i]) return false;
+	return true;
+}
+
+// lookup key matching the node whose name spells the same as the mpl::string Name
+// i.e. mpl::string<'two'> matches a node named mpl::string<'t','w','o'>
+template< typename Name >
+struct name_key
+{
+	template< typename Node >
+	static constexpr bool match() {
+		return chars_equal(static_name<typename Node::name>::value,
+			static_name<Name>::value.data(), static_name<Name>::size);
+	}
+};
+
+// number of leaves below a node
+template< typename Node >
+struct leaf_count
+	: leaf_count< typename tree_leaves<Node>::type > {};
+
+template< typename... Leaves >
+struct leaf_count< type_list<Leaves...> >
+	: std::integral_constant< std::size_t, sizeof...(Leaves) > {};
+
+// the first child in the type_list Children matched by Key
+// leaves_before counts the leaves of all children preceding it
+template< typename Key, typename Children >
+struct find_child
+{
+	static_assert(sizeof(Key) == 0, "no child matches the requested name");
+};
+
+template< typename Key, typename Child, typename Rest, bool Match = Key::template match<Child>() >
+struct find_child_step
+{
+	using type = Child;
+	static constexpr std::size_t leaves_before = 0;
+};
+
+template< typename Key, typename Child, typename Rest >
+struct find_child_step< Key, Child, Rest, false >
+{
+	using next = find_child<Key, Rest>;
+	using type = typename next::type;
+	static constexpr std::size_t leaves_before = leaf_count<Child>::value + next::leaves_before;
+};
+
+template< typename Key, typename Child, typename... Children >
+struct find_child< Key, type_list<Child, Children...> >
+	: find_child_step< Key, Child, type_list<Children...> > {};
+
+// the node reached from Node by following Keys, and the scan order
+// index of its first leaf
+template< typename Node, typename... Keys >
+struct resolve_path
+{
+	using type = Node;
+	static constexpr std::size_t leaf_index = 0;
+};
+
+template< typename Node, typename Key, typename... Keys >
+struct resolve_path< Node, Key, Keys... >
+{
+	using found = find_child< Key, typename Node::child_types >;
+	using next = resolve_path< typename found::type, Keys... >;
+	using type = typename next::type;
+	static constexpr std::size_t leaf_index = found::leaves_before + next::leaf_index;
+};
+
+template< typename Node >
+Node& get_path_impl(Node& n, type_list<>)
+{
+	return n;
+}
+
+// one static cast per level of the path
+template< typename Node, typename Key, typename... Keys >
+decltype(auto) get_path_impl(Node& n, type_list<Key, Keys...>)
+{
+	using child = typename find_child< Key, typename Node::child_types >::type;
+	return get_path_impl(get<child>(n), type_list<Keys...>{});
+}
+
+// The node below t named by the path Names..., resolved at compile time
+// get_path< mpl::string<'two'>, mpl::string<'three'>, mpl::string<'E'> >(bar)
+template< typename... Names, typename Tree >
+decltype(auto) get_path(Tree& t)
+{
+	return get_path_impl(t, type_list< name_key<Names>... >{});
+}
+
+// the scan order index of the leaf named by the path Names..., which is
+// also the index of its column in tree_layout and soa files
+template< typename Tree, typename... Names >
+struct leaf_index
+	: std::integral_constant< std::size_t,
+		resolve_path< Tree, name_key<Names>... >::leaf_index >
+{
+	static_assert(is_leaf< typename resolve_path< Tree, name_key<Names>... >::type >::value,
+		"leaf_index requires a path to a leaf");
+};
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+// a string literal usable as a template argument (C++20)
+template< std::size_t N >
+struct fixed_name
+{
+	constexpr fixed_name(const char (&s)[N]) {
+		for (std::size_t i = 0; i < N; ++i) chars[i] = s[i];
+	}
+
+	char chars[N];
+};
+
+template< fixed_name Name >
+struct literal_key
+{
+	template< typename Node >
+	static constexpr bool match() {
+		return chars_equal(static_name<typename Node::name>::value,
+			Name.chars, sizeof(Name.chars) - 1);
+	}
+};
+
+// get_path<"two", "three", "E">(bar)
+template< fixed_name... Names, typename Tree >
+decltype(auto) get_path(Tree& t)
+{
+	return get_path_impl(t, type_list< literal_key<Names>... >{});
+}
+
+template< typename Tree, fixed_name... Names >
+struct leaf_index_of_impl
+	: std::integral_constant< std::size_t,
+		resolve_path< Tree, literal_key<Names>... >::leaf_index >
+{
+	static_assert(is_leaf< typename resolve_path< Tree, literal_key<Names>... >::type >::value,
+		"leaf_index_of requires a path to a leaf");
+};
+
+// leaf_index_of<Bar, "two", "three", "E">
+template< typename Tree, fixed_name... Names >
+constexpr std::size_t leaf_index_of = leaf_index_of_impl< Tree, Names... >::value;
+
+#endif
+
+// ******************************************************************
+// RUNTIME FIELD LOOKUP BY NAME
+// ******************************************************************
+
+// a leaf together with the names of all nodes from the root down to it
+template< typename Names, typename Leaf >
+struct leaf_path
+{
+	using names = Names;
+	using leaf = Leaf;
+};
+
+// every leaf of a tree as a leaf_path, in scan order
+template< typename Node, typename Path = type_list<>,
+	typename IsLeaf = typename is_leaf<Node>::type >
+struct tree_leaf_paths
+{
+	using type = type_list< leaf_path<
+		typename type_list_cat< Path, type_list<typename Node::name> >::type, Node > >;
+};
+
+template< typename Path, typename Children >
+struct tree_leaf_paths_of;
+
+template< typename Path, typename... Children >
+struct tree_leaf_paths_of< Path, type_list<Children...> >
+	: type_list_cat< typename tree_leaf_paths<Children, Path>::type... > {};
+
+template< typename Node, typename Path >
+struct tree_leaf_paths< Node, Path, mpl::false_ >
+	: tree_leaf_paths_of< typename type_list_cat< Path, type_list<typename Node::name> >::type,
+		typename Node::child_types > {};
+
+// the compile time dotted name "one.two.D" of a list of names
+template< typename Names >
+struct dotted_name;
+
+template< typename Name, typename... Names >
+struct dotted_name< type_list<Name, Names...> >
+{
+	static constexpr std::array<char, 1> dot{ { '.' } };
+	static constexpr auto value = concat_chars(static_name<Name>::value,
+		concat_chars(dot, static_name<Names>::value)...);
+};
+
+// the child of a node holding its I-th leaf, and the index of that leaf
+// within the child
+template< std::size_t I, typename Children, bool Here = (I < leaf_count<
+	typename type_list_at<0, Children>::type >::value) >
+struct child_for_leaf
+{
+	using type = typename type_list_at<0, Children>::type;
+	static constexpr std::size_t index = I;
+};
+
+template< std::size_t I, typename Child, typename... Children >
+struct child_for_leaf< I, type_list<Child, Children...>, false >
+	: child_for_leaf< I - leaf_count<Child>::value, type_list<Children...> > {};
+
+// the I-th leaf (in scan order) below a node
+template< std::size_t I, typename Node >
+Node& leaf_at_impl(mpl::true_, Node& n)
+{
+	return n;
+}
+
+template< std::size_t I, typename Node >
+decltype(auto) leaf_at_impl(mpl::false_, Node& n)
+{
+	using step = child_for_leaf< I, typename Node::child_types >;
+	using child = typename step::type;
+	return leaf_at_impl<step::index>(is_leaf<child>{}, get<child>(n));
+}
+
+template< std::size_t I, typename Node >
+decltype(auto) leaf_at(Node& n)
+{
+	return leaf_at_impl<I>(is_leaf< typename std::remove_const<Node>::type >{}, n);
+}
+
+// a type_list without duplicates, keeping the first occurrence
+template< typename List, typename... Ts >
+struct type_list_unique { using type = List; };
+
+template< typename... As, typename T, typename... Ts >
+struct type_list_unique< type_list<As...>, T, Ts... >
+	: type_list_unique< typename std::conditional< (std::is_same<T, As>::value || ...),
+		type_list<As...>, type_list<As..., T> >::type, Ts... > {};
+
+// seeded 64 bit FNV-1a
+constexpr std::uint64_t field_hash(std::uint64_t seed, std::string_view s)
+{
+	std::uint64_t h = 0xcbf29ce484222325ull ^ (seed * 0x9E3779B97F4A7C15ull);
+	for (char c : s) h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+	return h ^ (h >> 29);
+}
+
+constexpr std::size_t next_pow2(std::size_t n)
+{
+	std::size_t p = 1;
+	while (p < n) p *= 2;
+	return p;
+}
+
+// Minimal perfect hash ("hash and displace") over N names, built at
+// compile time. A name hashes to one of N buckets, and every bucket
+// stores the seed that moves all of its names into free slots.
+template< std::size_t N >
+struct perfect_hash_table
+{
+	static constexpr std::size_t buckets = N > 0 ? N : 1;
+	static constexpr std::size_t slots = next_pow2(2 * buckets);
+
+	std::array<std::uint32_t, buckets> seed{};
+	std::array<std::int32_t, slots> slot{};
+	bool ok = false;
+
+	constexpr std::size_t bucket_of(std::string_view s) const {
+		return field_hash(0, s) % buckets;
+	}
+
+	constexpr std::size_t slot_of(std::uint32_t d, std::string_view s) const {
+		return field_hash(d, s) & (slots - 1);
+	}
+
+	// the index of name s, or -1
+	constexpr int find(std::string_view s, const std::array<std::string_view, N>& names) const {
+		const std::int32_t i = slot[slot_of(seed[bucket_of(s)], s)];
+		return (i >= 0 && names[i] == s) ? i : -1;
+	}
+};
+
+template< std::size_t N >
+constexpr perfect_hash_table<N> make_perfect_hash(const std::array<std::string_view, N>& names)
+{
+	using table_type = perfect_hash_table<N>;
+	table_type t{};
+	for (auto& s : t.slot) s = -1;
+
+	// counting sort of the names by bucket
+	std::array<std::size_t, table_type::buckets + 1> start{};
+	std::array<std::size_t, N> bucket{}, order{};
+	for (std::size_t i = 0; i < N; ++i) {
+		bucket[i] = t.bucket_of(names[i]);
+		++start[bucket[i] + 1];
+	}
+	for (std::size_t b = 0; b < table_type::buckets; ++b) start[b + 1] += start[b];
+	std::array<std::size_t, table_type::buckets + 1> next = start;
+	for (std::size_t i = 0; i < N; ++i) order[next[bucket[i]]++] = i;
+
+	// place the largest buckets first
+	for (std::size_t size = N; size > 0; --size) {
+		for (std::size_t b = 0; b < table_type::buckets; ++b) {
+			if (start[b + 1] - start[b] != size) continue;
+			bool placed = false;
+			for (std::uint32_t d = 1; !placed && d < (1u << 20); ++d) {
+				std::size_t k = start[b];
+				for (; k < start[b + 1]; ++k) {
+					const std::size_t s = t.slot_of(d, names[order[k]]);
+					if (t.slot[s] >= 0) break;
+					t.slot[s] = static_cast<std::int32_t>(order[k]);
+				}
+				placed = k == start[b + 1];
+				if (placed) t.seed[b] = d;
+				// undo the partial placement of this bucket
+				else while (k-- > start[b]) t.slot[t.slot_of(d, names[order[k]])] = -1;
+			}
+			if (!placed) return t;
+		}
+	}
+	t.ok = true;
+	return t;
+}
+
+template< typename... Paths >
+constexpr std::array<std::string_view, sizeof...(Paths)> make_field_names(type_list<Paths...>)
+{
+	return { { std::string_view(dotted_name<typename Paths::names>::value.data(),
+		dotted_name<typename Paths::names>::value.size())... } };
+}
+
+// the distinct leaf value types of a list of leaf_paths
+template< typename Paths >
+struct field_value_types;
+
+template< typename... Paths >
+struct field_value_types< type_list<Paths...> >
+	: type_list_unique< type_list<>, typename Paths::leaf::value_type... > {};
+
+template< typename... Paths >
+constexpr std::array<std::uint8_t, sizeof...(Paths)> make_field_tags(type_list<Paths...>)
+{
+	using types = typename field_value_types< type_list<Paths...> >::type;
+	return { { static_cast<std::uint8_t>(
+		type_list_index<typename Paths::leaf::value_type>(types{}))... } };
+}
+
+// record the byte offset of every leaf value of a tree object, in scan order
+struct leaf_offsets_f
+{
+	template<typename Parent, typename Child>
+	static void apply(const Parent& a, const unsigned char* base, std::size_t*& out) {
+		apply_impl(is_leaf<Child>{}, get<Child>(a), base, out);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, const Child& c, const unsigned char* base, std::size_t*& out) {
+		*out++ = static_cast<std::size_t>(reinterpret_cast<const unsigned char*>(&c.val) - base);
+	}
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, const Child& c, const unsigned char* base, std::size_t*& out) {
+		inher_tree_scan< leaf_offsets_f >(c, base, out);
+	}
+};
+
+// Byte offset of every leaf value within a Tree object, in scan order.
+// Base class offsets are not constant expressions, so the offsets are
+// taken once per Tree, on first use, from a static value initialized
+// Tree; they are shared by field_index and the table scans of all functors.
+template< typename Tree >
+const std::array< std::size_t, leaf_count<Tree>::value >& tree_leaf_offsets()
+{
+	static const auto offsets = [] {
+		static const Tree probe{};
+		std::array< std::size_t, leaf_count<Tree>::value > o{};
+		std::size_t* out = o.data();
+		inher_tree_scan< leaf_offsets_f >(probe, reinterpret_cast<const unsigned char*>(&probe), out);
+		return o;
+	}();
+	return offsets;
+}
+
+// Compile time index of the dotted names of all leaves of a Tree
+// * names[i] and type_tag[i] describe the i-th leaf in scan order
+// * type_tag is the index of the leaf value type within value_types
+// * offset(i) is the byte offset of the i-th leaf value within a Tree
+template< typename Tree >
+class field_index
+{
+public:
+	using paths = typename tree_leaf_paths<Tree>::type;
+	using value_types = typename field_value_types<paths>::type;
+
+	static constexpr std::size_t size = leaf_count<Tree>::value;
+	static constexpr std::array<std::string_view, size> names = make_field_names(paths{});
+	static constexpr std::array<std::uint8_t, size> type_tag = make_field_tags(paths{});
+	static constexpr perfect_hash_table<size> table = make_perfect_hash(names);
+
+	static_assert(table.ok, "leaf names must be unique to build a field_index");
+
+	// the scan order index of the leaf named s, or -1
+	static constexpr int find(std::string_view s) { return table.find(s, names); }
+
+	static std::size_t offset(std::size_t i) { return tree_leaf_offsets<Tree>()[i]; }
+};
+
+// call f with the value whose type is the Tag-th of Types at address p
+template< typename F, typename Byte, typename... Types, std::size_t... Tags >
+void visit_tag(std::size_t tag, Byte* p, F& f, type_list<Types...>, std::index_sequence<Tags...>)
+{
+	((tag == Tags ? (void)f(*reinterpret_cast<typename std::conditional<
+		std::is_const<Byte>::value, const Types, Types >::type*>(p)) : (void)0), ...);
+}
+
+// Call f with the value of the leaf of t named by the dotted path name,
+// e.g. "one.two.D"; f must accept every leaf value type of the Tree.
+// The name is resolved with a single perfect hash probe and one string
+// compare, followed by a switch over the leaf value types.
+// Returns false when the tree has no such leaf.
+template< typename Tree, typename F >
+bool visit_field(Tree& t, std::string_view name, F&& f)
+{
+	using index = field_index< typename std::remove_const<Tree>::type >;
+	using value_types = typename index::value_types;
+	using byte = typename std::conditional< std::is_const<Tree>::value,
+		const unsigned char, unsigned char >::type;
+
+	const int i = index::find(name);
+	if (i < 0) return false;
+
+	visit_tag(index::type_tag[i], reinterpret_cast<byte*>(&t) + index::offset(i), f,
+		value_types{}, std::make_index_sequence< type_list_size<value_types>::value >{});
+	return true;
+}
+
+// ******************************************************************
+// SHORT CIRCUITING AND FILTERED SCANS
+// ******************************************************************
+
+// Compile time leaf filters
+// * accepts<Leaf>::value selects the leaves that are visited at all
+// * descend<Node> is the filter applied to the children of Node
+// Rejected leaves generate no code.
+struct all_leaves
+{
+	template< typename Leaf > using accepts = mpl::true_;
+	template< typename Node > using descend = all_leaves;
+};
+
+// leaves whose value type satisfies Trait, e.g. leaves_where<std::is_floating_point>
+template< template< typename > class Trait >
+struct leaves_where
+{
+	template< typename Leaf >
+	using accepts = mpl::bool_< Trait< typename Leaf::value_type >::value >;
+	template< typename Node > using descend = leaves_where;
+};
+
+// the leaves accepted by Inner below the internal node named Name
+template< typename Name, typename Inner = all_leaves >
+struct under_name
+{
+	template< typename Leaf > using accepts = mpl::false_;
+	template< typename Node >
+	using descend = typename std::conditional<
+		name_key<Name>::template match<Node>(), Inner, under_name >::type;
+};
+
+constexpr std::size_t scan_npos = std::size_t(-1);
+
+template< typename Pred, typename Filter, std::size_t First, typename Node, typename... Params >
+std::size_t find_leaf(mpl::true_, Node& leaf, Params&... ps);
+
+template< typename Pred, typename Filter, std::size_t First, typename Node, typename... Params >
+std::size_t find_leaf(mpl::false_, Node& n, Params&... ps);
+
+template< typename Pred, std::size_t First, typename Node, typename... Params >
+std::size_t find_accepted(mpl::true_, Node& leaf, Params&... ps)
+{
+	return Pred::apply(leaf, First, ps...) ? First : scan_npos;
+}
+
+template< typename Pred, std::size_t First, typename Node, typename... Params >
+std::size_t find_accepted(mpl::false_, Node&, Params&...)
+{
+	return scan_npos;
+}
+
+template< typename Pred, typename Filter, std::size_t First, typename Leaf, typename... Params >
+std::size_t find_leaf(mpl::true_, Leaf& leaf, Params&... ps)
+{
+	using accepted = typename Filter::template accepts< typename std::remove_const<Leaf>::type >;
+	return find_accepted<Pred, First>(mpl::bool_<accepted::value>{}, leaf, ps...);
+}
+
+// first[i] is the number of leaves in the children preceding the i-th
+template< typename... Children >
+constexpr std::array<std::size_t, sizeof...(Children) + 1> children_first_leaf()
+{
+	const std::size_t counts[] = { leaf_count<Children>::value..., 0 };
+	std::array<std::size_t, sizeof...(Children) + 1> first{};
+	for (std::size_t i = 0; i < sizeof...(Children); ++i)
+		first[i + 1] = first[i] + counts[i];
+	return first;
+}
+
+template< typename Pred, typename Filter, std::size_t First, typename Node,
+	typename... Children, std::size_t... Is, typename... Params >
+std::size_t find_children_impl(Node& n, type_list<Children...>, std::index_sequence<Is...>, Params&... ps)
+{
+	constexpr auto first = children_first_leaf<Children...>();
+	std::size_t found = scan_npos;
+	(void)((found = find_leaf<Pred, Filter, First + first[Is]>(is_leaf<Children>{}, get<Children>(n), ps...),
+		found != scan_npos) || ...);
+	return found;
+}
+
+// the children are tried in scan order by a single || fold, which stops
+// at the first match
+template< typename Pred, typename Filter, std::size_t First, typename Node,
+	typename... Children, typename... Params >
+std::size_t find_children(Node& n, type_list<Children...> children, Params&... ps)
+{
+	return find_children_impl<Pred, Filter, First>(
+		n, children, std::index_sequence_for<Children...>{}, ps...);
+}
+
+template< typename Pred, typename Filter, std::size_t First, typename Node, typename... Params >
+std::size_t find_leaf(mpl::false_, Node& n, Params&... ps)
+{
+	using node = typename std::remove_const<Node>::type;
+	return find_children< Pred, typename Filter::template descend<node>, First >(
+		n, typename node::child_types{}, ps...);
+}
+
+// Scan order index of the first leaf of t accepted by Filter for which
+// Pred::apply(leaf, index, params...) returns true, or leaf_count<Tree>
+// if there is none. The scan stops at the first match. The root is
+// filtered like any other node, so under_name may name the root itself.
+template< typename Pred, typename Filter = all_leaves, typename Tree, typename... Params >
+std::size_t inher_tree_find(Tree& t, Params&&... ps)
+{
+	using tree = typename std::remove_const<Tree>::type;
+	const std::size_t found = find_leaf< Pred, Filter, 0 >(mpl::false_{}, t, ps...);
+	return found == scan_npos ? leaf_count<tree>::value : found;
+}
+
+template< typename Pred, typename Filter = all_leaves, typename Tree, typename... Params >
+bool inher_tree_any(Tree& t, Params&&... ps)
+{
+	using tree = typename std::remove_const<Tree>::type;
+	return inher_tree_find<Pred, Filter>(t, ps...) != leaf_count<tree>::value;
+}
+
+template< typename Pred >
+struct scan_not
+{
+	template< typename Leaf, typename... Params >
+	static bool apply(Leaf& leaf, std::size_t i, Params&... ps) { return !Pred::apply(leaf, i, ps...); }
+};
+
+// true when Pred holds for every leaf accepted by Filter
+template< typename Pred, typename Filter = all_leaves, typename Tree, typename... Params >
+bool inher_tree_all(Tree& t, Params&&... ps)
+{
+	return !inher_tree_any< scan_not<Pred>, Filter >(t, ps...);
+}
+
+template< typename Func >
+struct scan_visit
+{
+	template< typename Leaf, typename... Params >
+	static bool apply(Leaf& leaf, std::size_t i, Params&... ps) { Func::apply(leaf, i, ps...); return false; }
+};
+
+// Call Func::apply(leaf, index, params...) on every leaf accepted by Filter
+template< typename Func, typename Filter, typename Tree, typename... Params >
+void inher_tree_for_each(Tree& t, Params&&... ps)
+{
+	inher_tree_find< scan_visit<Func>, Filter >(t, ps...);
+}
+
+// ******************************************************************
+// FUSED SCAN PLANS
+// ******************************************************************
+
+// Fuses several leaf functors into a single traversal of the tree.
+// Every leaf accepted by Filter is visited once, in scan order, and
+// Funcs::apply(leaf, index, params...) is called on it for each of the
+// Funcs in the order listed, before the next leaf is visited. So every
+// functor sees a leaf after all functors before it have handled that
+// leaf, but before any of them has seen the following leaves; chains in
+// which a functor needs a complete earlier pass cannot be fused.
+// A plan is itself a leaf functor, plans nest: scan_plan< scan_plan<A, B>, C >
+template< typename... Funcs >
+struct scan_plan_each;
+
+template< typename... Funcs >
+struct scan_plan
+{
+	template< typename Leaf, typename... Params >
+	static void apply(Leaf& leaf, std::size_t i, Params&... ps) {
+		(Funcs::apply(leaf, i, ps...), ...);
+	}
+
+	// every functor receives all params
+	template< typename Filter = all_leaves, typename Tree, typename... Params >
+	static void run(Tree& t, Params&&... ps) {
+		inher_tree_for_each< scan_plan, Filter >(t, ps...);
+	}
+
+	// the k-th functor receives the elements of the k-th tuple, e.g.
+	// plan::run_with(t, std::tie(limit), std::tie(), std::tie(sum))
+	template< typename Filter = all_leaves, typename Tree, typename... Tuples >
+	static void run_with(Tree& t, Tuples&&... args) {
+		static_assert(sizeof...(Tuples) == sizeof...(Funcs), "run_with takes one tuple per functor");
+		inher_tree_for_each< scan_plan_each<Funcs...>, Filter >(t, args...);
+	}
+};
+
+template< typename... Funcs >
+struct scan_plan_each
+{
+	template< typename Leaf, typename... Tuples >
+	static void apply(Leaf& leaf, std::size_t i, Tuples&... args) {
+		(std::apply([&](auto&... ps) { Funcs::apply(leaf, i, ps...); }, args), ...);
+	}
+};
+
+// ******************************************************************
+// TYPE ERASED TABLE SCANS
+// ******************************************************************
+
+// A compact alternative to inher_tree_scan for code size sensitive call
+// sites. Instead of a chain of functions per node, a table scan is one
+// loop over the leaves: the offset of the leaf value, and a value op
+// picked by a small per leaf slot. A value op only sees the leaf value,
+// so it is instantiated once per distinct value type, however many
+// leaves (each a distinct LeafNode type) share it.
+// Each leaf costs an indirect call, so this suits cold or rarely run
+// operations on wide trees; the inlined scans remain the fast path.
+// Table scans call Func::apply(value, index, params...) for table_scan
+// and Func::apply(a_value, b_value, index, params...) for table_scan_zip.
+// Per leaf compile time traits reach the value ops as runtime tables
+// indexed by the leaf index, see table_leaf_traits. Pass them as
+// pointers: an array parameter would carry the leaf count into the type
+// of every value op, one instantiation per tree width.
+
+// The distinct leaf value types of a tree: slot[i] is the position of
+// the value type of leaf i among them, first[s] the first leaf of slot s.
+// type_list_index is instantiated once per distinct value type, which
+// keeps wide trees cheap and clear of the template recursion limit.
+template< typename Tree, typename Leaves = typename tree_leaves<Tree>::type >
+struct table_value_slots;
+
+template< typename Tree, typename... Leaves >
+struct table_value_slots< Tree, type_list<Leaves...> >
+{
+	using values = type_list< typename Leaves::value_type... >;
+	static constexpr std::size_t leaves = sizeof...(Leaves);
+
+	struct layout
+	{
+		std::array< std::uint16_t, leaves > slot{};
+		std::array< std::size_t, leaves > first{};
+		std::size_t count = 0;
+	};
+
+	static constexpr layout make() {
+		const std::size_t firsts[] = { type_list_index< typename Leaves::value_type >(values{})... };
+		layout l{};
+		for (std::size_t i = 0; i < leaves; ++i) {
+			if (firsts[i] == i) {
+				l.first[l.count] = i;
+				l.slot[i] = static_cast<std::uint16_t>(l.count++);
+			}
+			else l.slot[i] = l.slot[firsts[i]];
+		}
+		return l;
+	}
+
+	static constexpr layout value = make();
+
+	template< std::size_t S >
+	using type = typename type_list_at< value.first[S], values >::type;
+};
+
+template< typename From, typename To >
+using copy_const_t = typename std::conditional< std::is_const<From>::value, const To, To >::type;
+
+template< typename Func, typename T, typename Byte, typename... Params >
+void table_value_op(Byte* v, std::size_t i, Params&... ps)
+{
+	Func::apply(*reinterpret_cast< copy_const_t<Byte, T>* >(v), i, ps...);
+}
+
+template< typename Func, typename T, typename Byte, typename... Params >
+void table_zip_op(Byte* a, const unsigned char* b, std::size_t i, Params&... ps)
+{
+	Func::apply(*reinterpret_cast< copy_const_t<Byte, T>* >(a), *reinterpret_cast<const T*>(b), i, ps...);
+}
+
+// compile time tables of the value ops of Func, one per value slot of Tree
+template< typename Func, typename Tree, typename... Params >
+struct scan_table
+{
+	using tree = typename std::remove_const<Tree>::type;
+	using slots = table_value_slots<tree>;
+	using byte = copy_const_t<Tree, unsigned char>;
+	using value_fn = void (*)(byte*, std::size_t, Params&...);
+
+	template< std::size_t... S >
+	static constexpr std::array< value_fn, sizeof...(S) > make(std::index_sequence<S...>) {
+		return { { &table_value_op< Func, typename slots::template type<S>, byte, Params... >... } };
+	}
+
+	static constexpr auto ops = make(std::make_index_sequence< slots::value.count >{});
+};
+
+template< typename Func, typename Tree, typename... Params >
+struct scan_zip_table
+{
+	using tree = typename std::remove_const<Tree>::type;
+	using slots = table_value_slots<tree>;
+	using byte = copy_const_t<Tree, unsigned char>;
+	using value_fn = void (*)(byte*, const unsigned char*, std::size_t, Params&...);
+
+	template< std::size_t... S >
+	static constexpr std::array< value_fn, sizeof...(S) > make(std::index_sequence<S...>) {
+		return { { &table_zip_op< Func, typename slots::template type<S>, byte, Params... >... } };
+	}
+
+	static constexpr auto ops = make(std::make_index_sequence< slots::value.count >{});
+};
+
+// Call Func::apply(value, index, params...) on every leaf value of t, in scan order
+template< typename Func, typename Tree, typename... Params >
+void table_scan(Tree& t, Params&&... ps)
+{
+	using table = scan_table< Func, Tree, typename std::remove_reference<Params>::type... >;
+	const auto& offsets = tree_leaf_offsets< typename table::tree >();
+	const auto& slot = table::slots::value.slot;
+	typename table::byte* base = reinterpret_cast<typename table::byte*>(&t);
+	for (std::size_t i = 0; i < offsets.size(); ++i)
+		table::ops[slot[i]](base + offsets[i], i, ps...);
+}
+
+// Call Func::apply(a_value, b_value, index, params...) on every pair of
+// corresponding leaf values of two trees of the same type
+template< typename Func, typename Tree, typename... Params >
+void table_scan_zip(Tree& a, const typename std::remove_const<Tree>::type& b, Params&&... ps)
+{
+	using table = scan_zip_table< Func, Tree, typename std::remove_reference<Params>::type... >;
+	const auto& offsets = tree_leaf_offsets< typename table::tree >();
+	const auto& slot = table::slots::value.slot;
+	typename table::byte* base = reinterpret_cast<typename table::byte*>(&a);
+	const unsigned char* rhs = reinterpret_cast<const unsigned char*>(&b);
+	for (std::size_t i = 0; i < offsets.size(); ++i)
+		table::ops[slot[i]](base + offsets[i], rhs + offsets[i], i, ps...);
+}
+
+// the per leaf traits used by the generic operations, indexed by leaf
+template< typename Tree, typename Leaves = typename tree_leaves<Tree>::type >
+struct table_leaf_traits;
+
+template< typename Tree, typename... Leaves >
+struct table_leaf_traits< Tree, type_list<Leaves...> >
+{
+	static constexpr double mean[] = { rand_gen_params<Leaves>::mean... };
+	static constexpr double stddev[] = { rand_gen_params<Leaves>::stddev... };
+	static constexpr bool saturate[] = {
+		std::is_same< typename leaf_add_policy<Leaves>::type, add_saturate >::value... };
+};
+
+// value functors of the generic operations
+struct table_add_eq_f
+{
+	template< typename T >
+	static void apply(T& a, const T& b, std::size_t i, const bool* saturate) {
+		if (saturate[i]) leaf_kernel_add(a, b, add_saturate{}, typename leaf_kernel_kind<T>::type{});
+		else leaf_kernel_add(a, b, add_wrap{}, typename leaf_kernel_kind<T>::type{});
+	}
+};
+
+template< typename Generator >
+struct table_rand_gen_f
+{
+	template< typename T >
+	static void apply(T& v, std::size_t i, Generator& gen, const double* mean, const double* stddev) {
+		leaf_kernel_rand_gen(v, gen, mean[i], stddev[i], typename leaf_kernel_kind<T>::type{});
+	}
+};
+
+struct table_sum_f
+{
+	template< typename T >
+	static void apply(const T& v, std::size_t, double& sum) { leaf_reduce<reduce_sum>(sum, v); }
+};
+
+// a += b, a.rand_gen(gen) and tree_sum(t) as table scans
+template< typename Tree >
+void table_add_eq(Tree& a, const Tree& b)
+{
+	const bool* saturate = table_leaf_traits<Tree>::saturate;
+	table_scan_zip< table_add_eq_f >(a, b, saturate);
+}
+
+template< typename Tree, typename Generator >
+void table_rand_gen(Tree& t, Generator& gen)
+{
+	using traits = table_leaf_traits<Tree>;
+	const double* mean = traits::mean;
+	const double* stddev = traits::stddev;
+	table_scan< table_rand_gen_f<Generator> >(t, gen, mean, stddev);
+}
+
+template< typename Tree >
+double table_sum(const Tree& t)
+{
+	double sum = 0;
+	table_scan< table_sum_f >(t, sum);
+	return sum;
+}
+
+// ******************************************************************
+// SCAN INSTRUMENTATION
+// ******************************************************************
+
+// every node below the root of a tree as a leaf_path, in scan order
+// internal nodes come before their children
+template< typename Node, typename Path = type_list<>,
+	typename IsLeaf = typename is_leaf<Node>::type >
+struct tree_node_paths : tree_leaf_paths<Node, Path, IsLeaf> {};
+
+template< typename Path, typename Children >
+struct tree_node_paths_of;
+
+template< typename Path, typename... Children >
+struct tree_node_paths_of< Path, type_list<Children...> >
+	: type_list_cat< typename tree_node_paths<Children, Path>::type... > {};
+
+template< typename Node, typename Path >
+struct tree_node_paths< Node, Path, mpl::false_ >
+{
+	using names = typename type_list_cat< Path, type_list<typename Node::name> >::type;
+	using type = typename type_list_cat< type_list< leaf_path<names, Node> >,
+		typename tree_node_paths_of< names, typename Node::child_types >::type >::type;
+};
+
+// call and cycle counts of a single (Func, Child) pair
+struct instrument_counters
+{
+	std::atomic<std::uint64_t> calls{ 0 };
+	std::atomic<std::uint64_t> cycles{ 0 };
+};
+
+template< typename Func, typename Child >
+struct instrument_slot
+{
+	static inline instrument_counters counters;
+};
+
+// time stamp counter where available, nanoseconds otherwise
+inline std::uint64_t instrument_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Wraps a functor for inher_tree_scan and counts the calls and cycles
+// spent in Func::apply<Parent, Child> for every Child. While it runs, the
+// inher_tree_scan<Func> calls Func makes to recurse (directly or through
+// tree operators such as +=) go through the wrapper too, so every node
+// below is counted. The time of an internal child includes its children.
+// Without RAPID_INSTRUMENT defined instrumented<Func> is Func itself.
+#if defined(RAPID_INSTRUMENT)
+
+// holds instrument_depth<Func> one level deeper for its lifetime, so
+// that the depth is restored when the wrapped functor throws
+template< typename Func >
+struct instrument_depth_guard
+{
+	instrument_depth_guard() { ++instrument_depth<Func>; }
+	~instrument_depth_guard() { --instrument_depth<Func>; }
+	instrument_depth_guard(const instrument_depth_guard&) = delete;
+	instrument_depth_guard& operator=(const instrument_depth_guard&) = delete;
+};
+
+template< typename Func >
+struct instrumented
+{
+	template <typename Parent, typename Child, typename... Params>
+	static void apply(Parent& p, Params&&... ps)
+	{
+		const std::uint64_t start = instrument_clock();
+		{
+			instrument_depth_guard<Func> depth;
+			Func::template apply<Parent, Child>(p, std::forward<Params>(ps)...);
+		}
+		instrument_counters& c = instrument_slot<Func, Child>::counters;
+		c.cycles.fetch_add(instrument_clock() - start, std::memory_order_relaxed);
+		c.calls.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+#else
+template< typename Func >
+using instrumented = Func;
+#endif
+
+// the counters of one node, path is its dotted name e.g. "one.two.D"
+struct instrument_record
+{
+	std::string_view path;
+	std::uint64_t calls;
+	std::uint64_t cycles;
+};
+
+template< typename Func, typename... Paths >
+std::array<instrument_record, sizeof...(Paths)> instrument_records(type_list<Paths...>)
+{
+	return { { instrument_record{
+		std::string_view(dotted_name<typename Paths::names>::value.data(),
+			dotted_name<typename Paths::names>::value.size()),
+		instrument_slot<Func, typename Paths::leaf>::counters.calls.load(std::memory_order_relaxed),
+		instrument_slot<Func, typename Paths::leaf>::counters.cycles.load(std::memory_order_relaxed)
+	}... } };
+}
+
+template< typename Tree >
+using instrument_paths = typename tree_node_paths_of<
+	type_list<typename Tree::name>, typename Tree::child_types >::type;
+
+// Snapshot of the counters of instrumented<Func> for every node of Tree,
+// in scan order. Nodes are identified by type, so trees sharing a node
+// type share its counters.
+template< typename Func, typename Tree >
+std::array<instrument_record, type_list_size< instrument_paths<Tree> >::value> instrument_table()
+{
+	return instrument_records<Func>(instrument_paths<Tree>{});
+}
+
+template< typename Func, typename... Paths >
+void instrument_reset(type_list<Paths...>)
+{
+	((instrument_slot<Func, typename Paths::leaf>::counters.calls = 0,
+		instrument_slot<Func, typename Paths::leaf>::counters.cycles = 0), ...);
+}
+
+template< typename Func, typename Tree >
+void instrument_reset()
+{
+	instrument_reset<Func>(instrument_paths<Tree>{});
+}
+
+// write one "label,path,calls,cycles" line per node that was called
+template< typename Func, typename Tree >
+void instrument_export(std::ostream& os, std::string_view label)
+{
+	for (const instrument_record& r : instrument_table<Func, Tree>())
+		if (r.calls)
+			os << label << ',' << r.path << ',' << r.calls << ',' << r.cycles << '\n';
+}
+
+// ******************************************************************
+// EXPRESSION TEMPLATES FOR WHOLE TREE ARITHMETIC
+// ******************************************************************
+
+// terminal referring to an operand tree, evaluates to the current leaf value
+template< typename Tree >
+struct tree_ref
+{
+	template< typename Proj >
+	decltype(auto) eval(Proj proj) const { return proj(t).val; }
+
+	const Tree& t;
+};
+
+// terminal broadcasting a scalar to every leaf
+template< typename Scalar >
+struct tree_scalar
+{
+	template< typename Proj >
+	Scalar eval(Proj) const { return v; }
+
+	Scalar v;
+};
+
+// A lazily evaluated element wise operation over trees
+// Nothing is computed until the expression is assigned to a tree, which
+// then evaluates the whole expression leaf by leaf in a single scan.
+template< typename Op, typename... Args >
+struct tree_expr
+{
+	template< typename Proj >
+	auto eval(Proj proj) const {
+		return eval_impl(proj, std::index_sequence_for<Args...>{});
+	}
+
+	template< typename Proj, std::size_t... Is >
+	auto eval_impl(Proj proj, std::index_sequence<Is...>) const {
+		return Op::apply(std::get<Is>(args).eval(proj)...);
+	}
+
+	std::tuple<Args...> args;
+};
+
+struct expr_add { template< typename A, typename B > static auto apply(A a, B b) { return a + b; } };
+struct expr_sub { template< typename A, typename B > static auto apply(A a, B b) { return a - b; } };
+struct expr_mul { template< typename A, typename B > static auto apply(A a, B b) { return a * b; } };
+struct expr_div { template< typename A, typename B > static auto apply(A a, B b) { return a / b; } };
+
+// fused multiply add, a single rounding for floating point leaves
+struct expr_fma
+{
+	template< typename A, typename B, typename C >
+	static auto apply(A a, B b, C c) { return fma_impl(std::is_floating_point<decltype(a * b + c)>{}, a, b, c); }
+
+	template< typename A, typename B, typename C >
+	static auto fma_impl(std::true_type, A a, B b, C c) {
+		using T = decltype(a * b + c);
+		return std::fma(T(a), T(b), T(c));
+	}
+
+	template< typename A, typename B, typename C >
+	static auto fma_impl(std::false_type, A a, B b, C c) { return a * b + c; }
+};
+
+// operands of tree expressions: trees, expressions and scalars
+template< typename T >
+struct is_tree_expr_operand : mpl::false_ {};
+
+template< typename Name, typename... ChildNodes >
+struct is_tree_expr_operand< InternalNode<Name, ChildNodes...> > : mpl::true_ {};
+
+template< typename Op, typename... Args >
+struct is_tree_expr_operand< tree_expr<Op, Args...> > : mpl::true_ {};
+
+template< typename T >
+tree_ref<T> make_expr_arg(mpl::true_, const T& t) { return { t }; }
+
+template< typename Op, typename... Args >
+tree_expr<Op, Args...> make_expr_arg(mpl::true_, const tree_expr<Op, Args...>& e) { return e; }
+
+template< typename T >
+tree_scalar<T> make_expr_arg(mpl::false_, const T& v) { return { v }; }
+
+template< typename T >
+auto make_expr_arg(const T& t) { return make_expr_arg(is_tree_expr_operand<T>{}, t); }
+
+// at least one argument is a tree or an expression, the others are scalars
+template< typename... Ts >
+using enable_tree_expr = typename std::enable_if<
+	(is_tree_expr_operand<Ts>::value || ...) &&
+	((is_tree_expr_operand<Ts>::value || std::is_arithmetic<Ts>::value) && ...) >::type;
+
+template< typename Op, typename... Ts >
+auto make_tree_expr(const Ts&... ts)
+{
+	return tree_expr< Op, decltype(make_expr_arg(ts))... >{ { make_expr_arg(ts)... } };
+}
+
+template< typename L, typename R, typename = enable_tree_expr<L, R> >
+auto operator+(const L& l, const R& r) { return make_tree_expr<expr_add>(l, r); }
+
+template< typename L, typename R, typename = enable_tree_expr<L, R> >
+auto operator-(const L& l, const R& r) { return make_tree_expr<expr_sub>(l, r); }
+
+template< typename L, typename R, typename = enable_tree_expr<L, R> >
+auto operator*(const L& l, const R& r) { return make_tree_expr<expr_mul>(l, r); }
+
+template< typename L, typename R, typename = enable_tree_expr<L, R> >
+auto operator/(const L& l, const R& r) { return make_tree_expr<expr_div>(l, r); }
+
+// a * b + c, leaf by leaf
+template< typename A, typename B, typename C, typename = enable_tree_expr<A, B, C> >
+auto fma(const A& a, const B& b, const C& c) { return make_tree_expr<expr_fma>(a, b, c); }
+
+// ******************************************************************
+// ZERO COPY BINARY SERIALIZATION
+// ******************************************************************
+
+// position of a single leaf value within a binary layout
+struct leaf_layout
+{
+	std::size_t offset;
+	std::size_t size;
+	std::size_t align;
+};
+
+template< typename... Leaves >
+constexpr std::array< leaf_layout, sizeof...(Leaves) > make_leaf_layouts(type_list<Leaves...>)
+{
+	std::array< leaf_layout, sizeof...(Leaves) > layouts{};
+	std::size_t i = 0, offset = 0;
+	((layouts[i++] = leaf_layout{ offset, sizeof(typename Leaves::value_type),
+		alignof(typename Leaves::value_type) },
+		offset += sizeof(typename Leaves::value_type)), ...);
+	return layouts;
+}
+
+// Compile time descriptor of the flat packed layout of a Tree
+// * leaves are stored back to back in scan order, without padding
+// * leaf[i] gives the offset, size and alignment of the i-th leaf value
+template< typename Tree >
+struct tree_layout
+{
+	using leaves = typename tree_leaves<Tree>::type;
+
+	static constexpr std::size_t size = packed_size<Tree>::value;
+	static constexpr auto leaf = make_leaf_layouts(leaves{});
+	static constexpr std::size_t leaf_count = leaf.size();
+
+	// true when the in-memory representation can be used as the wire format
+	static constexpr bool trivially_copyable = std::is_trivially_copyable<Tree>::value;
+};
+
+// write a tree into out using the flat packed layout
+// out must provide tree_layout<Tree>::size bytes
+template< typename Tree >
+void serialize(const Tree& t, unsigned char* out)
+{
+	t.serialize(out);
+}
+
+// read a tree from the flat packed layout
+template< typename Tree >
+void deserialize(Tree& t, const unsigned char* in)
+{
+	t.deserialize(in);
+}
+
+// write a trivially copyable tree as a single memcpy of its in-memory
+// representation, out must provide sizeof(Tree) bytes
+template< typename Tree >
+void serialize_raw(const Tree& t, unsigned char* out)
+{
+	static_assert(tree_layout<Tree>::trivially_copyable,
+		"raw serialization requires a trivially copyable tree");
+	std::memcpy(out, &t, sizeof(Tree));
+}
+
+template< typename Tree >
+void deserialize_raw(Tree& t, const unsigned char* in)
+{
+	static_assert(tree_layout<Tree>::trivially_copyable,
+		"raw serialization requires a trivially copyable tree");
+	std::memcpy(&t, in, sizeof(Tree));
+}
+
+// view a buffer written by serialize_raw (e.g. a mmap-ed file) in place
+// the buffer must be aligned to alignof(Tree) and was produced by the same build
+template< typename Tree >
+const Tree* tree_view(const unsigned char* in)
+{
+	static_assert(tree_layout<Tree>::trivially_copyable,
+		"in place views require a trivially copyable tree");
+	return std::launder(reinterpret_cast<const Tree*>(in));
+}
+
+// ******************************************************************
+// HASHING, EQUALITY AND SORT KEYS
+// ******************************************************************
+
+// 64 x 64 -> 128 bit multiply, folded back into 64 bits
+inline std::uint64_t hash_mix(std::uint64_t a, std::uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	__extension__ typedef unsigned __int128 u128;
+	const u128 r = static_cast<u128>(a) * b;
+	return static_cast<std::uint64_t>(r) ^ static_cast<std::uint64_t>(r >> 64);
+#else
+	const std::uint64_t lo = (a & 0xffffffffu) * (b & 0xffffffffu);
+	const std::uint64_t m1 = (a >> 32) * (b & 0xffffffffu), m2 = (a & 0xffffffffu) * (b >> 32);
+	const std::uint64_t mid = (lo >> 32) + (m1 & 0xffffffffu) + (m2 & 0xffffffffu);
+	const std::uint64_t hi = (a >> 32) * (b >> 32) + (m1 >> 32) + (m2 >> 32) + (mid >> 32);
+	return ((mid << 32) | (lo & 0xffffffffu)) ^ hi;
+#endif
+}
+
+inline std::uint64_t hash_read64(const unsigned char* p) { std::uint64_t v; std::memcpy(&v, p, 8); return v; }
+inline std::uint64_t hash_read32(const unsigned char* p) { std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+constexpr std::uint64_t hash_secret[4] = {
+	0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+// wyhash style hash of n bytes. Inputs over 48 bytes are consumed by
+// three independent multiply lanes, so that their latencies overlap.
+inline std::uint64_t hash_bytes(const void* data, std::size_t n, std::uint64_t seed = 0)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+	std::uint64_t a = 0, b = 0;
+	if (n <= 16) {
+		if (n >= 4) {
+			const std::size_t q = (n >> 3) << 2;
+			a = (hash_read32(p) << 32) | hash_read32(p + q);
+			b = (hash_read32(p + n - 4) << 32) | hash_read32(p + n - 4 - q);
+		}
+		else if (n > 0) {
+			a = (std::uint64_t(p[0]) << 16) | (std::uint64_t(p[n >> 1]) << 8) | p[n - 1];
+		}
+	}
+	else {
+		std::size_t i = n;
+		if (i > 48) {
+			std::uint64_t s1 = seed, s2 = seed;
+			do {
+				seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+				s1 = hash_mix(hash_read64(p + 16) ^ hash_secret[2], hash_read64(p + 24) ^ s1);
+				s2 = hash_mix(hash_read64(p + 32) ^ hash_secret[3], hash_read64(p + 40) ^ s2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= s1 ^ s2;
+		}
+		for (; i > 16; i -= 16, p += 16)
+			seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+		a = hash_read64(p + i - 16);
+		b = hash_read64(p + i - 8);
+	}
+	return hash_mix(hash_secret[1] ^ n, hash_mix(a ^ hash_secret[1], b ^ seed));
+}
+
+// true for containers with contiguous data() and size()
+template< typename T, typename = void >
+struct has_contiguous_data : std::false_type {};
+
+template< typename T >
+struct has_contiguous_data< T, std::void_t<
+	decltype(std::declval<const T&>().data()), decltype(std::declval<const T&>().size()) > > : std::true_type {};
+
+// hash of a single leaf value, trivially copyable values are hashed by
+// their bytes, contiguous containers of them by their elements' bytes
+template< typename T >
+std::uint64_t hash_value(const T& v, std::uint64_t seed)
+{
+	if constexpr (std::is_trivially_copyable<T>::value)
+		return hash_bytes(&v, sizeof(T), seed);
+	else if constexpr (has_contiguous_data<T>::value &&
+		std::is_trivially_copyable< typename std::remove_pointer<decltype(v.data())>::type >::value)
+		return hash_bytes(v.data(), v.size() * sizeof(*v.data()), seed);
+	else
+		return hash_mix(seed ^ hash_secret[2], std::hash<T>{}(v) ^ hash_secret[3]);
+}
+
+template< typename Leaves >
+struct leaves_trivially_copyable;
+
+template< typename... Leaves >
+struct leaves_trivially_copyable< type_list<Leaves...> >
+	: std::integral_constant< bool, (std::is_trivially_copyable<typename Leaves::value_type>::value && ...) > {};
+
+// a generic hash functor template
+// formatted to match the interface required by inher_tree_scan
+struct hash_f
+{
+	template<typename Parent, typename Child>
+	static void apply(const Parent& a, std::uint64_t& h) {
+		apply_impl(is_leaf<Child>{}, get<Child>(a), h);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, const Child& c, std::uint64_t& h) { h = hash_value(c.val, h); }
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, const Child& c, std::uint64_t& h) { inher_tree_scan< hash_f >(c, h); }
+};
+
+// a generic equality functor template, eq is cleared by the first
+// differing leaf and the remaining leaves are skipped
+struct equal_f
+{
+	template<typename Parent, typename Child>
+	static void apply(const Parent& a, const Parent& b, bool& eq) {
+		if (eq) apply_impl(is_leaf<Child>{}, get<Child>(a), get<Child>(b), eq);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, const Child& c, const Child& d, bool& eq) { eq = leaf_equal(c.val, d.val); }
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, const Child& c, const Child& d, bool& eq) { inher_tree_scan< equal_f >(c, d, eq); }
+};
+
+// as equal_f, but leaves are compared with their own operator==
+struct value_equal_f
+{
+	template<typename Parent, typename Child>
+	static void apply(const Parent& a, const Parent& b, bool& eq) {
+		if (eq) apply_impl(is_leaf<Child>{}, get<Child>(a), get<Child>(b), eq);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, const Child& c, const Child& d, bool& eq) { eq = c.val == d.val; }
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, const Child& c, const Child& d, bool& eq) { inher_tree_scan< value_equal_f >(c, d, eq); }
+};
+
+// hash of all leaf values of t. Trees of trivially copyable leaves are
+// packed (free of padding) and hashed as a single buffer.
+template< typename Tree >
+std::uint64_t tree_hash(const Tree& t, std::uint64_t seed = 0)
+{
+	if constexpr (leaves_trivially_copyable< typename tree_leaves<Tree>::type >::value) {
+		unsigned char buf[tree_layout<Tree>::size];
+		serialize(t, buf);
+		return hash_bytes(buf, sizeof(buf), seed);
+	}
+	else {
+		std::uint64_t h = seed;
+		inher_tree_scan< hash_f >(t, h);
+		return h;
+	}
+}
+
+// leaf by leaf bitwise equality, consistent with tree_hash. A single
+// memcmp when the tree has no padding.
+template< typename Tree >
+bool tree_equal(const Tree& a, const Tree& b)
+{
+	if constexpr (std::is_trivially_copyable<Tree>::value && sizeof(Tree) == tree_layout<Tree>::size)
+		return std::memcmp(&a, &b, sizeof(Tree)) == 0;
+	else {
+		bool eq = true;
+		inher_tree_scan< equal_f >(a, b, eq);
+		return eq;
+	}
+}
+
+// leaf by leaf value equality, the leaves' own operator==. Unlike
+// tree_equal, 0.0 == -0.0 and a NaN differs from itself.
+template< typename Tree >
+bool tree_value_equal(const Tree& a, const Tree& b)
+{
+	bool eq = true;
+	inher_tree_scan< value_equal_f >(a, b, eq);
+	return eq;
+}
+
+// hash and key equality functors for unordered containers of trees,
+// e.g. std::unordered_set<Tree, tree_hasher, tree_key_equal>. Both are
+// bitwise: operator== would treat 0.0 and -0.0 as one key with two
+// hashes, and would never find a NaN key.
+struct tree_hasher
+{
+	template< typename Tree >
+	std::size_t operator()(const Tree& t) const { return static_cast<std::size_t>(tree_hash(t)); }
+};
+
+struct tree_key_equal
+{
+	template< typename Tree >
+	bool operator()(const Tree& a, const Tree& b) const { return tree_equal(a, b); }
+};
+
+// Order preserving big endian encoding of an arithmetic value: the keys
+// of two values compare with memcmp as the values compare with <
+// (floating point by the IEEE total order, -0.0 before 0.0)
+template< typename T >
+void key_encode(const T& v, unsigned char* out)
+{
+	static_assert(std::is_arithmetic<T>::value && sizeof(T) <= 8, "sort keys require arithmetic leaves");
+	using U = typename std::conditional< sizeof(T) == 1, std::uint8_t,
+		typename std::conditional< sizeof(T) == 2, std::uint16_t,
+		typename std::conditional< sizeof(T) == 4, std::uint32_t, std::uint64_t >::type >::type >::type;
+	constexpr U top = U(U(1) << (8 * sizeof(T) - 1));
+	U bits;
+	std::memcpy(&bits, &v, sizeof(T));
+	if constexpr (std::is_floating_point<T>::value)
+		bits = (bits & top) ? U(~bits) : U(bits ^ top);
+	else if constexpr (std::is_signed<T>::value)
+		bits = U(bits ^ top);
+	for (std::size_t i = 0; i < sizeof(T); ++i)
+		out[i] = static_cast<unsigned char>(bits >> (8 * (sizeof(T) - 1 - i)));
+}
+
+// the path of names of a leaf below the root of a tree, as for get_path
+template< typename... Names >
+struct key_path {};
+
+template< typename Tree, typename Path >
+struct key_leaf;
+
+template< typename Tree, typename... Names >
+struct key_leaf< Tree, key_path<Names...> >
+{
+	static constexpr std::size_t index = leaf_index<Tree, Names...>::value;
+	using value_type = typename type_list_at< index, typename tree_leaves<Tree>::type >::type::value_type;
+};
+
+// Lexicographic sort key over a chosen list of leaves, e.g.
+// tree_sort_key< Bar, key_path<mpl::string<'G'>>, key_path<mpl::string<'two'>, mpl::string<'D'>> >
+// Keys compare with memcmp in the order of the tuple of these leaves,
+// byte by byte, which makes them suitable for radix sorts.
+template< typename Tree, typename... Paths >
+struct tree_sort_key
+{
+	static constexpr std::size_t size = (std::size_t(0) + ... + sizeof(typename key_leaf<Tree, Paths>::value_type));
+	using type = std::array<unsigned char, size>;
+
+	static type make(const Tree& t) {
+		type key{};
+		unsigned char* out = key.data();
+		((key_encode(leaf_at< key_leaf<Tree, Paths>::index >(t).val, out),
+			out += sizeof(typename key_leaf<Tree, Paths>::value_type)), ...);
+		return key;
+	}
+};
+
+template< typename... Paths, typename Tree >
+typename tree_sort_key<Tree, Paths...>::type sort_key(const Tree& t)
+{
+	return tree_sort_key<Tree, Paths...>::make(t);
+}
+
+// The permutation sorting trees[0, n) by the key over Paths, stable.
+// LSD radix sort over the key bytes, bytes equal in all keys are skipped.
+template< typename... Paths, typename Tree >
+std::vector<std::size_t> sort_index(const Tree* trees, std::size_t n)
+{
+	using key = tree_sort_key<Tree, Paths...>;
+	std::vector<typename key::type> keys(n);
+	for (std::size_t i = 0; i < n; ++i) keys[i] = key::make(trees[i]);
+
+	std::vector<std::size_t> index(n), next(n);
+	for (std::size_t i = 0; i < n; ++i) index[i] = i;
+	for (std::size_t byte = key::size; byte-- > 0; ) {
+		std::array<std::size_t, 257> count{};
+		for (std::size_t i = 0; i < n; ++i) ++count[keys[i][byte] + 1];
+		if (count[keys.empty() ? 0 : keys[0][byte] + 1] == n) continue;
+		for (std::size_t c = 1; c < count.size(); ++c) count[c] += count[c - 1];
+		for (std::size_t i : index) next[count[keys[i][byte]]++] = i;
+		index.swap(next);
+	}
+	return index;
+}
+
+// ******************************************************************
+// PADDING AWARE LEAF ORDERING
+// ******************************************************************
+
+// Leaves marked hot are stored ahead of all others by packed_tree, so the
+// fields read on every pass share the first cache lines of a record.
+// Specialize for individual leaves.
+template< typename Leaf >
+struct hot_leaf : mpl::false_ {};
+
+template< typename Leaves >
+struct any_hot_leaf;
+
+template< typename... Leaves >
+struct any_hot_leaf< type_list<Leaves...> >
+	: mpl::bool_< (hot_leaf<Leaves>::value || ... || false) > {};
+
+// a subtree counts as hot when any of its leaves is
+template< typename Node >
+struct hot_node : any_hot_leaf< typename tree_leaves<Node>::type > {};
+
+// stable storage order of the children: hot before cold, then by
+// decreasing alignment, which leaves no padding between siblings
+template< typename... Children >
+constexpr std::array< std::size_t, sizeof...(Children) > packed_order(type_list<Children...>)
+{
+	constexpr bool hot[] = { hot_node<Children>::value..., false };
+	constexpr std::size_t align[] = { alignof(Children)..., 0 };
+	std::array< std::size_t, sizeof...(Children) > order{};
+	for (std::size_t i = 0; i < order.size(); ++i) {
+		std::size_t j = i;
+		for (; j > 0; --j) {
+			const std::size_t prev = order[j - 1];
+			if (hot[prev] > hot[i] || (hot[prev] == hot[i] && align[prev] >= align[i])) break;
+			order[j] = prev;
+		}
+		order[j] = i;
+	}
+	return order;
+}
+
+template< typename Node, typename IsLeaf = typename is_leaf<Node>::type >
+struct packed_tree_of { using type = Node; };
+
+template< typename Name, typename Children, std::size_t... Is >
+InternalNode< Name, typename type_list_at< packed_order(Children{})[Is], Children >::type... >
+	packed_node(std::index_sequence<Is...>);
+
+template< typename Name, typename... ChildNodes >
+struct packed_tree_of< InternalNode<Name, ChildNodes...>, mpl::false_ >
+{
+	using children = type_list< typename packed_tree_of<ChildNodes>::type... >;
+	using type = decltype(packed_node< Name, children >(
+		std::make_index_sequence< sizeof...(ChildNodes) >{}));
+};
+
+// Tree with the children of every internal node reordered by packed_order.
+// Names, nesting and leaf types are unchanged, so get<Leaf>, get_path and
+// visit_field work as before; only the scan order, and with it leaf
+// indices and serialized layouts, differ from Tree.
+template< typename Tree >
+using packed_tree = typename packed_tree_of<Tree>::type;
+
+template< typename Dst, typename Src, typename... Leaves >
+void copy_leaves(Dst& dst, const Src& src, type_list<Leaves...>)
+{
+	((get<Leaves>(dst).val = get<Leaves>(src).val), ...);
+}
+
+// convert between a tree and its packed_tree, leaf by leaf
+template< typename Tree >
+packed_tree<Tree> pack_tree(const Tree& t)
+{
+	packed_tree<Tree> p;
+	copy_leaves(p, t, typename tree_leaves<Tree>::type{});
+	return p;
+}
+
+template< typename Tree >
+void unpack_tree(const packed_tree<Tree>& p, Tree& t)
+{
+	copy_leaves(t, p, typename tree_leaves<Tree>::type{});
+}
+
+// ******************************************************************
+// INCREMENTAL DIRTY TRACKING AND DELTA SERIALIZATION
+// ******************************************************************
+
+inline unsigned dirty_ctz(std::uint64_t m)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return static_cast<unsigned>(__builtin_ctzll(m));
+#else
+	unsigned n = 0;
+	while (!(m & 1)) { m >>= 1; ++n; }
+	return n;
+#endif
+}
+
+inline unsigned dirty_popcount(std::uint64_t m)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return static_cast<unsigned>(__builtin_popcountll(m));
+#else
+	unsigned n = 0;
+	for (; m; m &= m - 1) ++n;
+	return n;
+#endif
+}
+
+// Fixed size bitset with one bit per leaf in scan order
+// for_each visits the set bits only, a word at a time
+template< std::size_t N >
+struct dirty_bits
+{
+	static constexpr std::size_t size = N;
+	static constexpr std::size_t words = (N + 63) / 64;
+
+	std::array<std::uint64_t, words> word{};
+
+	void set(std::size_t i) { word[i / 64] |= std::uint64_t(1) << (i % 64); }
+	void reset(std::size_t i) { word[i / 64] &= ~(std::uint64_t(1) << (i % 64)); }
+	bool test(std::size_t i) const { return (word[i / 64] >> (i % 64)) & 1; }
+	void clear() { word.fill(0); }
+
+	void set_all() {
+		word.fill(~std::uint64_t(0));
+		if (N % 64) word[words - 1] = (std::uint64_t(1) << (N % 64)) - 1;
+	}
+
+	bool any() const {
+		for (std::uint64_t w : word) if (w) return true;
+		return false;
+	}
+
+	// false when a bit at or past N is set, e.g. in a bitset read from the wire
+	bool in_range() const {
+		return N % 64 == 0 || (word[words - 1] >> (N % 64)) == 0;
+	}
+
+	std::size_t count() const {
+		std::size_t n = 0;
+		for (std::uint64_t w : word) n += dirty_popcount(w);
+		return n;
+	}
+
+	// the number of set bits before bit i
+	std::size_t rank(std::size_t i) const {
+		std::size_t n = 0;
+		for (std::size_t k = 0; k < i / 64; ++k) n += dirty_popcount(word[k]);
+		if (i % 64) n += dirty_popcount(word[i / 64] & ((std::uint64_t(1) << (i % 64)) - 1));
+		return n;
+	}
+
+	dirty_bits& operator|=(const dirty_bits& rhs) {
+		for (std::size_t k = 0; k < words; ++k) word[k] |= rhs.word[k];
+		return *this;
+	}
+
+	template< typename F >
+	void for_each(F&& f) const {
+		for (std::size_t k = 0; k < words; ++k)
+			for (std::uint64_t m = word[k]; m; m &= m - 1)
+				f(k * 64 + dirty_ctz(m));
+	}
+};
+
+// true when the I-th leaf values of a and b differ, see leaf_equal
+// (bitwise for trivially copyable values, by contents otherwise)
+template< std::size_t I, typename Tree >
+bool leaf_differs(const Tree& a, const Tree& b)
+{
+	return !leaf_equal(leaf_at<I>(a).val, leaf_at<I>(b).val);
+}
+
+template< typename Tree, std::size_t... Is >
+dirty_bits< sizeof...(Is) > diff_leaves(const Tree& a, const Tree& b, std::index_sequence<Is...>)
+{
+	dirty_bits< sizeof...(Is) > bits;
+	((leaf_differs<Is>(a, b) ? bits.set(Is) : (void)0), ...);
+	return bits;
+}
+
+// Structural diff of two trees of the same schema, the set bits are the
+// scan order indices of the leaves whose values differ
+template< typename Tree >
+dirty_bits< leaf_count<Tree>::value > diff_leaves(const Tree& a, const Tree& b)
+{
+	return diff_leaves(a, b, std::make_index_sequence< leaf_count<Tree>::value >{});
+}
+
+template< typename Func, std::size_t I, typename Tree, typename... Params >
+void scan_bits_leaf(Tree& t, Params&... params)
+{
+	Func::apply(leaf_at<I>(t), I, params...);
+}
+
+template< typename Func, typename Tree, typename... Params, std::size_t... Is >
+void scan_bits_impl(Tree& t, const dirty_bits< sizeof...(Is) >& bits,
+	std::index_sequence<Is...>, Params&... params)
+{
+	using leaf_fn = void (*)(Tree&, Params&...);
+	static constexpr leaf_fn table[] = { &scan_bits_leaf< Func, Is, Tree, Params... >... };
+	bits.for_each([&](std::size_t i) { table[i](t, params...); });
+}
+
+// Visit the leaves of t whose bits are set, in scan order. Func is called
+// as Func::apply(leaf, index, params...) for each of them; this is the
+// leaf level contract, apply<Parent, Child> scan functors do not fit it.
+// bits must be in_range.
+template< typename Func, typename Tree, typename... Params >
+void scan_bits(Tree& t,
+	const dirty_bits< leaf_count< typename std::remove_const<Tree>::type >::value >& bits,
+	Params&&... params)
+{
+	scan_bits_impl<Func>(t, bits,
+		std::make_index_sequence< leaf_count< typename std::remove_const<Tree>::type >::value >{},
+		params...);
+}
+
+// Opt-in wrapper that records which leaves of a Tree changed since the
+// dirty set was last cleared. All mutation goes through the wrapper:
+// * set<I> and modify<I> mark the I-th leaf if its value changed
+// * visit applies a mutating visitor to every leaf, marking the changed ones
+// * operator= and operator+= diff the tree before and after
+// A tracked copy of an existing tree starts fully dirty, a default
+// constructed one starts clean.
+template< typename Tree >
+class TrackedNode
+{
+	template< std::size_t I, typename F >
+	void modify_leaf(F& f) {
+		auto& v = leaf_at<I>(tree_).val;
+		const auto old = v;
+		f(v);
+		if (!leaf_equal(old, v)) dirty_.set(I);
+	}
+
+	template< typename F, std::size_t... Is >
+	void visit(F& f, std::index_sequence<Is...>) {
+		(modify_leaf<Is>(f), ...);
+	}
+
+public:
+	using tree_type = Tree;
+	static constexpr std::size_t leaf_count = ::leaf_count<Tree>::value;
+	using bits_type = dirty_bits<leaf_count>;
+
+	TrackedNode() = default;
+	explicit TrackedNode(const Tree& t) : tree_(t) { dirty_.set_all(); }
+
+	const Tree& tree() const { return tree_; }
+	const bits_type& dirty() const { return dirty_; }
+	bool is_dirty() const { return dirty_.any(); }
+	void clear_dirty() { dirty_.clear(); }
+	void mark_all() { dirty_.set_all(); }
+
+	// the value of the I-th leaf in scan order, see leaf_index
+	template< std::size_t I >
+	const auto& get() const { return leaf_at<I>(tree_).val; }
+
+	template< std::size_t I, typename V >
+	void set(const V& v) {
+		auto assign = [&](auto& x) { x = v; };
+		modify_leaf<I>(assign);
+	}
+
+	template< std::size_t I, typename F >
+	void modify(F&& f) { modify_leaf<I>(f); }
+
+	template< typename F >
+	void visit(F&& f) { visit(f, std::make_index_sequence<leaf_count>{}); }
+
+	TrackedNode& operator=(const Tree& rhs) {
+		dirty_ |= diff_leaves(tree_, rhs);
+		tree_ = rhs;
+		return *this;
+	}
+
+	template< typename Rhs >
+	TrackedNode& operator+=(const Rhs& rhs) {
+		const Tree old = tree_;
+		tree_ += rhs;
+		dirty_ |= diff_leaves(old, tree_);
+		return *this;
+	}
+
+private:
+	Tree tree_{};
+	bits_type dirty_{};
+};
+
+// Visit only the leaves of a TrackedNode that changed, in scan order
+// Func is called as Func::apply(leaf, index, params...)
+template< typename Func, typename Tree, typename... Params >
+void scan_dirty(const TrackedNode<Tree>& t, Params&&... params)
+{
+	scan_bits<Func>(t.tree(), t.dirty(), params...);
+}
+
+struct delta_store_f
+{
+	template <typename Leaf>
+	static void apply(const Leaf& leaf, std::size_t, unsigned char*& out)
+	{
+		leaf.serialize(out);
+		out += sizeof(typename Leaf::value_type);
+	}
+};
+
+struct delta_load_f
+{
+	template <typename Leaf>
+	static void apply(Leaf& leaf, std::size_t, const unsigned char*& in)
+	{
+		leaf.deserialize(in);
+		in += sizeof(typename Leaf::value_type);
+	}
+};
+
+// bytes needed by serialize_delta for the leaves in bits
+template< typename Tree >
+std::size_t delta_size(const dirty_bits< leaf_count<Tree>::value >& bits)
+{
+	std::size_t n = sizeof(bits.word);
+	bits.for_each([&](std::size_t i) { n += tree_layout<Tree>::leaf[i].size; });
+	return n;
+}
+
+// Write the changed leaves of t as a delta record:
+// * the dirty bitset, as dirty_bits<N>::words 64 bit host order words
+// * the packed values of the dirty leaves, back to back in scan order
+// out must provide delta_size<Tree>(t.dirty()) bytes. Returns the bytes
+// written; the dirty set is left for the caller to clear.
+template< typename Tree >
+std::size_t serialize_delta(const TrackedNode<Tree>& t, unsigned char* out)
+{
+	unsigned char* const begin = out;
+	std::memcpy(out, t.dirty().word.data(), sizeof(t.dirty().word));
+	out += sizeof(t.dirty().word);
+	scan_dirty<delta_store_f>(t, out);
+	return static_cast<std::size_t>(out - begin);
+}
+
+// Apply the delta record written by serialize_delta in the first bytes
+// of in to t and return the bytes read, leaves absent from the record are
+// left untouched. Returns 0, leaving t untouched, when the record is
+// truncated or marks leaves t does not have.
+template< typename Tree >
+std::size_t deserialize_delta(Tree& t, const unsigned char* in, std::size_t bytes)
+{
+	const unsigned char* const begin = in;
+	dirty_bits< leaf_count<Tree>::value > bits;
+	if (bytes < sizeof(bits.word)) return 0;
+	std::memcpy(bits.word.data(), in, sizeof(bits.word));
+	if (!bits.in_range() || delta_size<Tree>(bits) > bytes) return 0;
+	in += sizeof(bits.word);
+	scan_bits<delta_load_f>(t, bits, in);
+	return static_cast<std::size_t>(in - begin);
+}
+
+// ******************************************************************
+// SPARSE TREES WITH A PRESENCE BITMAP
+// ******************************************************************
+
+// Compact storage for trees of which only a few leaves are populated
+// * a bitmap marks the present leaves, in scan order
+// * present leaves are packed, in scan order, into a single buffer, each
+//   at the prefix sum of the sizes of the present leaves before it,
+//   rounded up to its own alignment; a large leaf only costs its own bytes
+// Absent leaves read as value initialized. Inserting or erasing a leaf
+// repacks the buffer, leaf values must be trivially copyable.
+template< typename Tree >
+class SparseTree
+{
+	using leaves = typename tree_leaves<Tree>::type;
+
+	template< typename... Ls >
+	static constexpr std::size_t max_align(type_list<Ls...>) { return std::max({ alignof(Ls)... }); }
+
+	template< typename... Ls >
+	static constexpr bool trivial(type_list<Ls...>) {
+		return (std::is_trivially_copyable<Ls>::value && ...);
+	}
+
+	template< typename... Ls >
+	static constexpr std::array<std::size_t, sizeof...(Ls)> sizes(type_list<Ls...>) { return { { sizeof(Ls)... } }; }
+
+	template< typename... Ls >
+	static constexpr std::array<std::size_t, sizeof...(Ls)> aligns(type_list<Ls...>) { return { { alignof(Ls)... } }; }
+
+	static_assert(trivial(leaves{}), "sparse trees require trivially copyable leaves");
+
+	// the buffer is a vector of blocks, aligned for every leaf
+	struct alignas(max_align(leaves{})) block
+	{
+		unsigned char bytes[max_align(leaves{})];
+	};
+
+public:
+	using tree_type = Tree;
+	static constexpr std::size_t leaf_count = ::leaf_count<Tree>::value;
+	using bits_type = dirty_bits<leaf_count>;
+
+	template< std::size_t I >
+	using leaf_type = typename type_list_at<I, leaves>::type;
+
+	SparseTree() = default;
+
+	// every leaf of t that is not bitwise zero becomes present
+	explicit SparseTree(const Tree& t) {
+		assign(t, std::make_index_sequence<leaf_count>{});
+	}
+
+	template< std::size_t I >
+	bool has() const { return present_.test(I); }
+
+	// the I-th leaf, nullptr when absent
+	template< std::size_t I >
+	const leaf_type<I>* find() const {
+		return has<I>() ? at<I>(offset(I)) : nullptr;
+	}
+
+	template< std::size_t I >
+	leaf_type<I>* find() {
+		return has<I>() ? at<I>(offset(I)) : nullptr;
+	}
+
+	// the I-th leaf, inserted value initialized when absent
+	template< std::size_t I >
+	leaf_type<I>& get() {
+		if (!has<I>()) {
+			bits_type next = present_;
+			next.set(I);
+			repack(next);
+			::new (static_cast<void*>(data() + offset(I))) leaf_type<I>();
+		}
+		return *at<I>(offset(I));
+	}
+
+	template< std::size_t I >
+	void set(const typename leaf_type<I>::value_type& v) { get<I>().val = v; }
+
+	template< std::size_t I >
+	void erase() {
+		if (!has<I>()) return;
+		bits_type next = present_;
+		next.reset(I);
+		repack(next);
+	}
+
+	void clear() {
+		blocks_.clear();
+		present_.clear();
+	}
+
+	// the number of present leaves
+	std::size_t size() const { return present_.count(); }
+
+	const bits_type& present() const { return present_; }
+
+	// bytes held by this object, including its buffer
+	std::size_t resident_bytes() const { return sizeof(*this) + blocks_.capacity() * sizeof(block); }
+
+	void shrink_to_fit() { blocks_.shrink_to_fit(); }
+
+	// the full tree, absent leaves value initialized
+	Tree tree() const {
+		Tree t{};
+		expand(t, std::make_index_sequence<leaf_count>{});
+		return t;
+	}
+
+private:
+	template< typename Func, typename T, typename... Params, std::size_t... Is >
+	friend void scan_sparse_impl(SparseTree<T>&, std::index_sequence<Is...>, Params&...);
+
+	template< typename Func, std::size_t I, typename T, typename... Params >
+	friend void scan_sparse_leaf(SparseTree<T>&, std::size_t, Params&...);
+
+	static constexpr std::array<std::size_t, leaf_count> leaf_size = sizes(leaves{});
+	static constexpr std::array<std::size_t, leaf_count> leaf_align = aligns(leaves{});
+
+	// call f(i, offset) for every leaf i present in bits, in scan order,
+	// returns the packed size
+	template< typename F >
+	static std::size_t layout(const bits_type& bits, F&& f) {
+		std::size_t end = 0;
+		bits.for_each([&](std::size_t i) {
+			const std::size_t off = (end + leaf_align[i] - 1) / leaf_align[i] * leaf_align[i];
+			f(i, off);
+			end = off + leaf_size[i];
+		});
+		return end;
+	}
+
+	// the byte offset of the present leaf i
+	std::size_t offset(std::size_t i) const {
+		std::size_t r = 0;
+		layout(present_, [&](std::size_t j, std::size_t off) { if (j == i) r = off; });
+		return r;
+	}
+
+	// move the present leaves that remain in next to the layout of next
+	void repack(const bits_type& next) {
+		std::array<std::size_t, leaf_count> from{};
+		layout(present_, [&](std::size_t j, std::size_t off) { from[j] = off; });
+		const std::size_t bytes = layout(next, [](std::size_t, std::size_t) {});
+		std::vector<block> out((bytes + sizeof(block) - 1) / sizeof(block));
+		unsigned char* dst = reinterpret_cast<unsigned char*>(out.data());
+		layout(next, [&](std::size_t j, std::size_t off) {
+			if (present_.test(j)) std::memcpy(dst + off, data() + from[j], leaf_size[j]);
+		});
+		blocks_ = std::move(out);
+		present_ = next;
+	}
+
+	unsigned char* data() { return reinterpret_cast<unsigned char*>(blocks_.data()); }
+	const unsigned char* data() const { return reinterpret_cast<const unsigned char*>(blocks_.data()); }
+
+	template< std::size_t I >
+	leaf_type<I>* at(std::size_t off) {
+		return std::launder(reinterpret_cast< leaf_type<I>* >(data() + off));
+	}
+
+	template< std::size_t I >
+	const leaf_type<I>* at(std::size_t off) const {
+		return std::launder(reinterpret_cast< const leaf_type<I>* >(data() + off));
+	}
+
+	// a single repack, then every nonzero leaf copied into place
+	template< std::size_t... Is >
+	void assign(const Tree& t, std::index_sequence<Is...>) {
+		const auto nonzero = [](const auto& v) {
+			const unsigned char* p = reinterpret_cast<const unsigned char*>(&v);
+			return std::any_of(p, p + sizeof(v), [](unsigned char c) { return c != 0; });
+		};
+		bits_type next;
+		((nonzero(leaf_at<Is>(t).val) ? next.set(Is) : (void)0), ...);
+		repack(next);
+		std::array<std::size_t, leaf_count> off{};
+		layout(present_, [&](std::size_t j, std::size_t o) { off[j] = o; });
+		((has<Is>() ? (void)::new (static_cast<void*>(data() + off[Is])) leaf_type<Is>(leaf_at<Is>(t)) : (void)0), ...);
+	}
+
+	template< std::size_t... Is >
+	void expand(Tree& t, std::index_sequence<Is...>) const {
+		((has<Is>() ? (void)(leaf_at<Is>(t) = *find<Is>()) : (void)0), ...);
+	}
+
+	bits_type present_;
+	std::vector<block> blocks_;
+};
+
+template< typename Func, std::size_t I, typename Tree, typename... Params >
+void scan_sparse_leaf(SparseTree<Tree>& s, std::size_t off, Params&... params)
+{
+	Func::apply(*s.template at<I>(off), I, params...);
+}
+
+template< typename Func, typename Tree, typename... Params, std::size_t... Is >
+void scan_sparse_impl(SparseTree<Tree>& s, std::index_sequence<Is...>, Params&... params)
+{
+	using leaf_fn = void (*)(SparseTree<Tree>&, std::size_t, Params&...);
+	static constexpr leaf_fn table[] = { &scan_sparse_leaf< Func, Is, Tree, Params... >... };
+	SparseTree<Tree>::layout(s.present(), [&](std::size_t i, std::size_t off) { table[i](s, off, params...); });
+}
+
+// Visit the present leaves of s in scan order, absent leaves cost nothing.
+// Func is called as Func::apply(leaf, index, params...), as for scan_bits.
+template< typename Func, typename Tree, typename... Params >
+void scan_sparse(SparseTree<Tree>& s, Params&&... params)
+{
+	scan_sparse_impl<Func>(s, std::make_index_sequence< SparseTree<Tree>::leaf_count >{}, params...);
+}
+
+// ******************************************************************
+// ARENA ALLOCATED DYNAMIC LEAVES
+// ******************************************************************
+
+// leaves whose payload lives on the heap, allocated from a memory_resource
+template<typename Name, typename T>
+using pmr_vector_leaf = LeafNode< Name, std::pmr::vector<T> >;
+
+template<typename Name>
+using pmr_string_leaf = LeafNode< Name, std::pmr::string >;
+
+// Move v into storage obtained from r. Allocator aware containers do not
+// propagate their allocator on assignment, so the value is rebuilt in place.
+template<typename T>
+void bind_resource(T& v, std::pmr::memory_resource* r, std::true_type)
+{
+	T rebound(std::move(v), typename T::allocator_type(r));
+	v.~T();
+	::new (static_cast<void*>(&v)) T(std::move(rebound));
+}
+
+// plain values have nothing to allocate
+template<typename T>
+void bind_resource(T&, std::pmr::memory_resource*, std::false_type) {}
+
+// passes a memory resource down through inher_tree_scan to every leaf
+struct bind_resource_f
+{
+	template <typename Parent, typename Child>
+	static void apply(Parent& p, std::pmr::memory_resource* r)
+	{
+		apply_leaf(is_leaf<Child>{}, get<Child>(p), r);
+	}
+
+	template <typename Leaf>
+	static void apply_leaf(mpl::true_, Leaf& l, std::pmr::memory_resource* r)
+	{
+		using T = typename Leaf::value_type;
+		bind_resource(l.val, r, std::uses_allocator<T, std::pmr::memory_resource*>{});
+	}
+
+	template <typename Node>
+	static void apply_leaf(mpl::false_, Node& n, std::pmr::memory_resource* r)
+	{
+		inher_tree_scan< bind_resource_f >(n, r);
+	}
+};
+
+// Make every allocator aware leaf of t allocate from r. Leaves assigned
+// afterwards keep r, so t = other copies other's payloads into r.
+template<typename Tree>
+void tree_bind_resource(Tree& t, std::pmr::memory_resource* r)
+{
+	inher_tree_scan< bind_resource_f >(t, r);
+}
+
+// copy src into a new tree whose payloads are allocated from r
+template<typename Tree>
+Tree tree_clone(const Tree& src, std::pmr::memory_resource* r)
+{
+	Tree t;
+	tree_bind_resource(t, r);
+	t = src;
+	return t;
+}
+
+// Bump arena for the trees of a single request
+// * make / make_batch return trees whose payloads are carved from the arena
+// * deallocation through the arena is a no-op, release frees everything
+//   at once; trees made from the arena must be destroyed before that
+class tree_arena
+{
+public:
+	explicit tree_arena(std::size_t initial_bytes = 64 * 1024)
+		: resource_(initial_bytes) {}
+
+	tree_arena(const tree_arena&) = delete;
+	tree_arena& operator=(const tree_arena&) = delete;
+
+	std::pmr::memory_resource* resource() { return &resource_; }
+
+	template<typename Tree>
+	Tree make() {
+		Tree t;
+		tree_bind_resource(t, &resource_);
+		return t;
+	}
+
+	// n default trees, the vector storage itself is also in the arena
+	template<typename Tree>
+	std::pmr::vector<Tree> make_batch(std::size_t n) {
+		std::pmr::vector<Tree> batch(n, &resource_);
+		for (Tree& t : batch) tree_bind_resource(t, &resource_);
+		return batch;
+	}
+
+	void release() { resource_.release(); }
+
+private:
+	std::pmr::monotonic_buffer_resource resource_;
+};
+
+// ******************************************************************
+// SIMD KERNELS FOR CONTIGUOUS COLUMNS
+// ******************************************************************
+
+// Classify a leaf value type by the vector kernel able to process it
+struct simd_scalar {};
+struct simd_f32 {};
+struct simd_f64 {};
+struct simd_i32 {};
+struct simd_i64 {};
+
+template<typename T>
+struct simd_kind
+{
+	using type =
+		typename std::conditional< std::is_same<T, float>::value, simd_f32,
+		typename std::conditional< std::is_same<T, double>::value, simd_f64,
+		typename std::conditional< std::is_integral<T>::value && sizeof(T) == 4, simd_i32,
+		typename std::conditional< std::is_integral<T>::value && sizeof(T) == 8, simd_i64,
+		simd_scalar >::type >::type >::type >::type;
+};
+
+// The vector operations available for a value type T
+// The default is a width 1 "vector", i.e. a plain scalar loop
+template<typename T, typename Kind = typename simd_kind<T>::type>
+struct simd_ops
+{
+	using vec = T;
+	static constexpr std::size_t width = 1;
+	static vec load(const T* p) { return *p; }
+	static void store(T* p, vec v) { *p = v; }
+	static vec add(vec a, vec b) { return a + b; }
+};
+
+#if defined(__AVX512F__)
+
+template<typename T>
+struct simd_ops<T, simd_f32>
+{
+	using vec = __m512;
+	static constexpr std::size_t width = 16;
+	static vec load(const T* p) { return _mm512_loadu_ps(p); }
+	static void store(T* p, vec v) { _mm512_storeu_ps(p, v); }
+	static vec add(vec a, vec b) { return _mm512_add_ps(a, b); }
+};
+
+template<typename T>
+struct simd_ops<T, simd_f64>
+{
+	using vec = __m512d;
+	static constexpr std::size_t width = 8;
+	static vec load(const T* p) { return _mm512_loadu_pd(p); }
+	static void store(T* p, vec v) { _mm512_storeu_pd(p, v); }
+	static vec add(vec a, vec b) { return _mm512_add_pd(a, b); }
+};
+
+template<typename T>
+struct simd_ops<T, simd_i32>
+{
+	using vec = __m512i;
+	static constexpr std::size_t width = 16;
+	static vec load(const T* p) { return _mm512_loadu_si512(p); }
+	static void store(T* p, vec v) { _mm512_storeu_si512(p, v); }
+	static vec add(vec a, vec b) { return _mm512_add_epi32(a, b); }
+};
+
+template<typename T>
+struct simd_ops<T, simd_i64>
+{
+	using vec = __m512i;
+	static constexpr std::size_t width = 8;
+	static vec load(const T* p) { return _mm512_loadu_si512(p); }
+	static void store(T* p, vec v) { _mm512_storeu_si512(p, v); }
+	static vec add(vec a, vec b) { return _mm512_add_epi64(a, b); }
+};
+
+#elif defined(__AVX2__)
+
+template<typename T>
+struct simd_ops<T, simd_f32>
+{
+	using vec = __m256;
+	static constexpr std::size_t width = 8;
+	static vec load(const T* p) { return _mm256_loadu_ps(p); }
+	static void store(T* p, vec v) { _mm256_storeu_ps(p, v); }
+	static vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+};
+
+template<typename T>
+struct simd_ops<T, simd_f64>
+{
+	using vec = __m256d;
+	static constexpr std::size_t width = 4;
+	static vec load(const T* p) { return _mm256_loadu_pd(p); }
+	static void store(T* p, vec v) { _mm256_storeu_pd(p, v); }
+	static vec add(vec a, vec b) { return _mm256_add_pd(a, b); }
+};
+
+template<typename T>
+struct simd_ops<T, simd_i32>
+{
+	using vec = __m256i;
+	static constexpr std::size_t width = 8;
+	static vec load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	static void store(T* p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	static vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+};
+
+template<typename T>
+struct simd_ops<T, simd_i64>
+{
+	using vec = __m256i;
+	static constexpr std::size_t width = 4;
+	static vec load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	static void store(T* p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	static vec add(vec a, vec b) { return _mm256_add_epi64(a, b); }
+};
+
+#elif defined(__ARM_NEON)
+
+template<typename T>
+struct simd_ops<T, simd_f32>
+{
+	using vec = float32x4_t;
+	static constexpr std::size_t width = 4;
+	static vec load(const T* p) { return vld1q_f32(p); }
+	static void store(T* p, vec v) { vst1q_f32(p, v); }
+	static vec add(vec a, vec b) { return vaddq_f32(a, b); }
+};
+
+#if defined(__aarch64__)
+template<typename T>
+struct simd_ops<T, simd_f64>
+{
+	using vec = float64x2_t;
+	static constexpr std::size_t width = 2;
+	static vec load(const T* p) { return vld1q_f64(p); }
+	static void store(T* p, vec v) { vst1q_f64(p, v); }
+	static vec add(vec a, vec b) { return vaddq_f64(a, b); }
+};
+#endif
+
+template<typename T>
+struct simd_ops<T, simd_i32>
+{
+	using vec = int32x4_t;
+	static constexpr std::size_t width = 4;
+	static vec load(const T* p) { return vld1q_s32(reinterpret_cast<const int32_t*>(p)); }
+	static void store(T* p, vec v) { vst1q_s32(reinterpret_cast<int32_t*>(p), v); }
+	static vec add(vec a, vec b) { return vaddq_s32(a, b); }
+};
+
+template<typename T>
+struct simd_ops<T, simd_i64>
+{
+	using vec = int64x2_t;
+	static constexpr std::size_t width = 2;
+	static vec load(const T* p) { return vld1q_s64(reinterpret_cast<const int64_t*>(p)); }
+	static void store(T* p, vec v) { vst1q_s64(reinterpret_cast<int64_t*>(p), v); }
+	static vec add(vec a, vec b) { return vaddq_s64(a, b); }
+};
+
+#endif
+
+// dst[i] += src[i] for i in [0, n)
+// full vectors are processed with simd_ops<T>, the remainder with a scalar tail
+template<typename T>
+void simd_add_eq(T* dst, const T* src, std::size_t n)
+{
+	using ops = simd_ops<T>;
+	std::size_t i = 0;
+	for (; i + ops::width <= n; i += ops::width)
+		ops::store(dst + i, ops::add(ops::load(dst + i), ops::load(src + i)));
+	for (; i < n; ++i) dst[i] += src[i];
+}
+
+// column wise dst[i] += src[i] honouring the leaf_add_policy of Leaf
+// plain arithmetic columns take the simd loop, everything else the scalar kernel
+template<typename Leaf, typename T>
+void column_add_eq(T* dst, const T* src, std::size_t n)
+{
+	using kind = typename leaf_kernel_kind<T>::type;
+	constexpr bool simd = std::is_same< typename leaf_add_policy<Leaf>::type, add_wrap >::value
+		&& (std::is_same<kind, kernel_integral>::value || std::is_same<kind, kernel_floating>::value);
+	if constexpr (simd)
+		simd_add_eq(dst, src, n);
+	else
+		for (std::size_t i = 0; i < n; ++i) leaf_add_eq<Leaf>(dst[i], src[i]);
+}
+
+// ******************************************************************
+// STRUCTURE OF ARRAYS CONTAINER FOR BATCHES OF TREES
+// ******************************************************************
+
+// A contiguous column of bool with a real data(), the storage of bool
+// leaves, so that column kernels see a bool* like for any other leaf
+// (std::vector<bool> packs its values into bits)
+class bool_column
+{
+public:
+	using value_type = bool;
+
+	bool_column() = default;
+	bool_column(const bool_column& rhs) : bool_column() { *this = rhs; }
+	bool_column(bool_column&&) noexcept = default;
+	bool_column& operator=(bool_column&&) noexcept = default;
+
+	bool_column& operator=(const bool_column& rhs) {
+		if (this != &rhs) {
+			std::unique_ptr<bool[]> p(rhs.n_ ? new bool[rhs.n_] : nullptr);
+			std::copy(rhs.data(), rhs.data() + rhs.n_, p.get());
+			p_ = std::move(p);
+			n_ = rhs.n_;
+		}
+		return *this;
+	}
+
+	std::size_t size() const { return n_; }
+	bool empty() const { return n_ == 0; }
+
+	// new values are false, like std::vector<bool>::resize
+	void resize(std::size_t n) {
+		if (n == n_) return;
+		std::unique_ptr<bool[]> p(n ? new bool[n]() : nullptr);
+		std::copy(data(), data() + std::min(n, n_), p.get());
+		p_ = std::move(p);
+		n_ = n;
+	}
+
+	bool* data() { return p_.get(); }
+	const bool* data() const { return p_.get(); }
+
+	bool& operator[](std::size_t i) { return p_[i]; }
+	const bool& operator[](std::size_t i) const { return p_[i]; }
+
+	bool* begin() { return data(); }
+	bool* end() { return data() + n_; }
+	const bool* begin() const { return data(); }
+	const bool* end() const { return data() + n_; }
+
+private:
+	std::unique_ptr<bool[]> p_;
+	std::size_t n_ = 0;
+};
+
+// the column type holding the values of a leaf of type T
+template<typename T>
+struct soa_column { using type = std::vector<T>; };
+
+template<>
+struct soa_column<bool> { using type = bool_column; };
+
+// Mirror of an inheritance tree in which every LeafNode<Name, T> is
+// replaced by a contiguous column of T. The mirror defines its own 
+// base_type, so it is walked by the very same inher_tree_scan (and the
+// very same functors) as the tree it mirrors.
+template<typename Node>
+struct soa_node;
+
+// resize every column of a soa_node
+struct soa_resize_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, std::size_t n) {
+		get<Child>(a).resize(n);
+	}
+};
+
+// copy a tree into row i of a soa_node
+struct soa_store_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, const typename Parent::node_type& t, std::size_t i) {
+		get<Child>(a).store(get<typename Child::node_type>(t), i);
+	}
+};
+
+// copy row i of a soa_node into a tree
+struct soa_load_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, typename Parent::node_type& t, std::size_t i) {
+		get<Child>(a).load(get<typename Child::node_type>(t), i);
+	}
+};
+
+// add a tree onto row i of a soa_node
+struct soa_add_row_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, const typename Parent::node_type& t, std::size_t i) {
+		get<Child>(a).add_row(get<typename Child::node_type>(t), i);
+	}
+};
+
+// internal nodes simply forward every operation to their children
+template<typename Name, typename... ChildNodes>
+struct soa_node< InternalNode<Name, ChildNodes...> >
+	: soa_node<ChildNodes>...
+{
+	using name = Name;
+	using node_type = InternalNode<Name, ChildNodes...>;
+	using base_type = mpl::vector< soa_node<ChildNodes>... >;
+	using child_types = type_list< soa_node<ChildNodes>... >;
+
+	void resize(std::size_t n) { inher_tree_scan< soa_resize_f >(*this, n); }
+
+	void store(const node_type& t, std::size_t i) {
+		inher_tree_scan< soa_store_f >(*this, t, i);
+	}
+
+	void load(node_type& t, std::size_t i) const {
+		inher_tree_scan< soa_load_f >(*this, t, i);
+	}
+
+	void add_row(const node_type& t, std::size_t i) {
+		inher_tree_scan< soa_add_row_f >(*this, t, i);
+	}
+
+	// column wise addition, reuses the add_eq functor of InternalNode
+	soa_node& operator+=(const soa_node& rhs) {
+		inher_tree_scan< add_eq >(*this, rhs);
+		return *this;
+	}
+};
+
+// leaf nodes own a single contiguous column
+template<typename Name, typename T>
+struct soa_node< LeafNode<Name, T> >
+{
+	using name = Name;
+	using node_type = LeafNode<Name, T>;
+
+	void resize(std::size_t n) { col.resize(n); }
+
+	void store(const node_type& l, std::size_t i) { col[i] = l.val; }
+
+	void load(node_type& l, std::size_t i) const { l.val = col[i]; }
+
+	void add_row(const node_type& l, std::size_t i) { leaf_add_eq<node_type>(col[i], l.val); }
+
+	// a single unit stride, vectorized loop per column
+	soa_node& operator+=(const soa_node& rhs) {
+		column_add_eq<node_type>(col.data(), rhs.col.data(), col.size());
+		return *this;
+	}
+
+	typename soa_column<T>::type col;
+};
+
+template<typename Tree>
+class TreeSoA;
+
+// A proxy reference to row i of a TreeSoA which behaves like a Tree&
+// * reading converts the row into a Tree
+// * assignment and += write straight into the columns
+template<typename Tree>
+class soa_ref
+{
+public:
+	soa_ref(TreeSoA<Tree>& s, std::size_t i) : s_(s), i_(i) {}
+
+	operator Tree() const {
+		Tree t;
+		s_.load(t, i_);
+		return t;
+	}
+
+	soa_ref& operator=(const Tree& t) {
+		s_.store(t, i_);
+		return *this;
+	}
+
+	soa_ref& operator=(const soa_ref& rhs) { return *this = Tree(rhs); }
+
+	soa_ref& operator+=(const Tree& t) {
+		s_.add_row(t, i_);
+		return *this;
+	}
+
+	// direct access to a single leaf value of the row
+	template<typename Leaf>
+	typename Leaf::value_type& get() const {
+		return s_.template column<Leaf>()[i_];
+	}
+
+	void print(std::string prefix = "") const { Tree(*this).print(prefix); }
+
+private:
+	TreeSoA<Tree>& s_;
+	std::size_t i_;
+};
+
+// A batch of trees stored as one contiguous array per LeafNode
+// Batch operations (such as +=) and single column scans only touch
+// the cache lines of the columns they actually use.
+template<typename Tree>
+class TreeSoA
+	: public soa_node<Tree>
+{
+public:
+	using reference = soa_ref<Tree>;
+
+	explicit TreeSoA(std::size_t n = 0) : n_(0) { resize(n); }
+
+	std::size_t size() const { return n_; }
+
+	void resize(std::size_t n) {
+		soa_node<Tree>::resize(n);
+		n_ = n;
+	}
+
+	void push_back(const Tree& t) {
+		resize(n_ + 1);
+		this->store(t, n_ - 1);
+	}
+
+	reference operator[](std::size_t i) { return reference(*this, i); }
+
+	Tree operator[](std::size_t i) const {
+		Tree t;
+		this->load(t, i);
+		return t;
+	}
+
+	// the contiguous column of a single leaf
+	template<typename Leaf>
+	typename soa_column<typename Leaf::value_type>::type& column() {
+		return get< soa_node<Leaf> >(*this).col;
+	}
+
+	template<typename Leaf>
+	const typename soa_column<typename Leaf::value_type>::type& column() const {
+		return get< soa_node<Leaf> >(*this).col;
+	}
+
+	// the column of the I-th leaf in scan order, see leaf_index
+	template<std::size_t I>
+	auto& column_at() {
+		return column< typename type_list_at< I, typename tree_leaves<Tree>::type >::type >();
+	}
+
+	// element wise addition of two equally sized batches
+	TreeSoA& operator+=(const TreeSoA& rhs) {
+		if (rhs.size() != size())
+			throw std::invalid_argument("TreeSoA::operator+=: batch sizes differ, " +
+				std::to_string(size()) + " += " + std::to_string(rhs.size()));
+		soa_node<Tree>::operator+=(rhs);
+		return *this;
+	}
+
+private:
+	std::size_t n_;
+};
+
+// ******************************************************************
+// BATCH ARITHMETIC OVER ARRAYS OF TREES
+// ******************************************************************
+
+// dst[i] += src[i] for two equally sized batches of trees stored as
+// structures of arrays, every column is added with simd_add_eq.
+// Throws std::invalid_argument when the sizes differ.
+// There is no overload for arrays of trees: their leaves are strided, and
+// transposing them into lanes costs more than the dst[i] += src[i] loop
+// it would replace. Keep batches that are added in bulk in a TreeSoA.
+template<typename Tree>
+void tree_add_eq(TreeSoA<Tree>& dst, const TreeSoA<Tree>& src)
+{
+	dst += src;
+}
+
+// ******************************************************************
+// CONCURRENT ACCUMULATION INTO SHARED TREES
+// ******************************************************************
+
+// Lock free element operations on a plain leaf value, through
+// std::atomic_ref where available and the equivalent builtins otherwise.
+// Relaxed ordering: the accumulated totals are published by whatever
+// synchronizes the threads afterwards, e.g. join.
+template<typename T>
+T atomic_leaf_load(const T& v)
+{
+#if defined(__cpp_lib_atomic_ref)
+	return std::atomic_ref<T>(const_cast<T&>(v)).load(std::memory_order_relaxed);
+#else
+	T r;
+	__atomic_load(&v, &r, __ATOMIC_RELAXED);
+	return r;
+#endif
+}
+
+// integers added with wrap around, a single fetch_add
+template<typename T>
+void atomic_leaf_add(T& dst, T v, add_wrap, kernel_integral)
+{
+#if defined(__cpp_lib_atomic_ref)
+	std::atomic_ref<T>(dst).fetch_add(v, std::memory_order_relaxed);
+#else
+	__atomic_fetch_add(&dst, v, __ATOMIC_RELAXED);
+#endif
+}
+
+// bool, where a += b is a logical or under either policy: a single store
+// of true when v is set, the effect of a fetch_or
+template<typename Policy>
+void atomic_leaf_add(bool& dst, bool v, Policy, kernel_generic)
+{
+	if (!v) return;
+#if defined(__cpp_lib_atomic_ref)
+	std::atomic_ref<bool>(dst).store(true, std::memory_order_relaxed);
+#else
+	__atomic_store_n(&dst, true, __ATOMIC_RELAXED);
+#endif
+}
+
+// everything else (floating point, saturating integers), a compare and
+// swap loop around the leaf_kernel_add of the policy
+template<typename T, typename Policy, typename Kind>
+void atomic_leaf_add(T& dst, T v, Policy p, Kind k)
+{
+	auto next = [&](T old) { leaf_kernel_add(old, v, p, k); return old; };
+#if defined(__cpp_lib_atomic_ref)
+	std::atomic_ref<T> ref(dst);
+	T old = ref.load(std::memory_order_relaxed);
+	while (!ref.compare_exchange_weak(old, next(old), std::memory_order_relaxed)) {}
+#else
+	T old = atomic_leaf_load(dst);
+	T desired = next(old);
+	while (!__atomic_compare_exchange(&dst, &old, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		desired = next(old);
+#endif
+}
+
+// atomic dst += v honouring the leaf_add_policy of Leaf
+template<typename Leaf, typename T>
+void atomic_leaf_add(T& dst, T v)
+{
+	static_assert(std::is_arithmetic<T>::value, "atomic accumulation requires arithmetic leaves");
+	atomic_leaf_add(dst, v, typename leaf_add_policy<Leaf>::type{}, typename leaf_kernel_kind<T>::type{});
+}
+
+// the add_eq functor with every leaf addition made atomic
+// any number of threads may add into the same a concurrently
+struct atomic_add_eq
+{
+	template <typename Parent, typename Child, typename Rhs>
+	static void apply(Parent& a, const Rhs& b)
+	{
+		apply_impl(is_leaf<Child>{}, get<Child>(a), get_matching<Parent, Child>(b));
+	}
+
+private:
+	template <typename Leaf, typename RhsLeaf>
+	static void apply_impl(mpl::true_, Leaf& a, const RhsLeaf& b) {
+		atomic_leaf_add<Leaf>(a.val, b.val);
+	}
+
+	template <typename Node, typename RhsNode>
+	static void apply_impl(mpl::false_, Node& a, const RhsNode& b) {
+		inher_tree_scan< atomic_add_eq >(a, b);
+	}
+};
+
+// copy a tree that other threads may be adding into, leaf by leaf
+struct atomic_load_f
+{
+	template <typename Parent, typename Child>
+	static void apply(Parent& dst, const Parent& src)
+	{
+		apply_impl(is_leaf<Child>{}, get<Child>(dst), get<Child>(src));
+	}
+
+private:
+	template <typename Leaf>
+	static void apply_impl(mpl::true_, Leaf& dst, const Leaf& src) {
+		dst.val = atomic_leaf_load(src.val);
+	}
+
+	template <typename Node>
+	static void apply_impl(mpl::false_, Node& dst, const Node& src) {
+		inher_tree_scan< atomic_load_f >(dst, src);
+	}
+};
+
+// shared += local without a mutex; readers of shared should use atomic_tree_load
+template<typename Tree, typename Rhs>
+void atomic_tree_add(Tree& shared, const Rhs& local)
+{
+	inher_tree_scan< atomic_add_eq >(shared, local);
+}
+
+template<typename Tree>
+Tree atomic_tree_load(const Tree& shared)
+{
+	Tree t;
+	inher_tree_scan< atomic_load_f >(t, shared);
+	return t;
+}
+
+constexpr std::size_t cache_line_size = 64;
+
+// Sharded accumulator for many writer threads
+// * add() goes to the calling thread's shard, each on its own cache lines
+// * value() merges the shards lazily, only when read
+// Threads are assigned to shards round robin on first use, threads sharing
+// a shard stay correct as shards are updated with atomic_add_eq.
+template<typename Tree>
+class ThreadLocalTree
+{
+	struct alignas(cache_line_size) shard
+	{
+		Tree tree{};
+	};
+
+public:
+	explicit ThreadLocalTree(std::size_t shards = std::thread::hardware_concurrency())
+		: shards_(std::max<std::size_t>(shards, 1)) {}
+
+	std::size_t shard_count() const { return shards_.size(); }
+
+	template<typename Rhs>
+	void add(const Rhs& local) {
+		atomic_tree_add(shards_[thread_slot() % shards_.size()].tree, local);
+	}
+
+	template<typename Rhs>
+	ThreadLocalTree& operator+=(const Rhs& local) {
+		add(local);
+		return *this;
+	}
+
+	// the sum over all shards, may run concurrently with add
+	Tree value() const {
+		Tree total{};
+		for (const shard& s : shards_) total += atomic_tree_load(s.tree);
+		return total;
+	}
+
+	// must not run concurrently with add
+	void reset() {
+		for (shard& s : shards_) s.tree = Tree{};
+	}
+
+private:
+	static std::size_t thread_slot() {
+		static std::atomic<std::size_t> next{ 0 };
+		thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+		return slot;
+	}
+
+	std::vector<shard> shards_;
+};
+
+// ******************************************************************
+// SNAPSHOT VERSIONED TREES FOR READ HEAVY CONSUMERS
+// ******************************************************************
+
+// Persistent mirror of an inheritance tree. Leaves are held by value
+// inside their parent, every internal node is an immutable,
+// reference counted object, so versions share all unchanged subtrees.
+template< typename Node >
+struct snap_node;
+
+template< typename Node, typename IsLeaf = typename is_leaf<Node>::type >
+struct snap_holder_of { using type = Node; };
+
+template< typename Node >
+struct snap_holder_of< Node, mpl::false_ > { using type = std::shared_ptr< const snap_node<Node> >; };
+
+template< typename Node >
+using snap_holder = typename snap_holder_of<Node>::type;
+
+template< typename Name, typename... ChildNodes >
+struct snap_node< InternalNode<Name, ChildNodes...> >
+{
+	using node_type = InternalNode<Name, ChildNodes...>;
+	using child_types = type_list< ChildNodes... >;
+
+	std::tuple< snap_holder<ChildNodes>... > kids;
+};
+
+// the node held by a holder
+template< typename Leaf >
+const Leaf& snap_deref(const Leaf& l) { return l; }
+
+template< typename Node >
+const snap_node<Node>& snap_deref(const std::shared_ptr< const snap_node<Node> >& p) { return *p; }
+
+// true when the two leaves hold equal values, see leaf_equal
+template< typename Leaf >
+bool snap_same(const Leaf& a, const Leaf& b)
+{
+	return leaf_equal(a.val, b.val);
+}
+
+template< typename Node >
+bool snap_same(const std::shared_ptr< const snap_node<Node> >& a,
+	const std::shared_ptr< const snap_node<Node> >& b)
+{
+	return a == b;
+}
+
+// Build the holder of n, reusing every subtree of old (when given)
+// whose leaves all compare equal to those of n
+template< typename Leaf >
+Leaf snap_build(mpl::true_, const Leaf& n, const Leaf*) { return n; }
+
+template< typename Node >
+snap_holder<Node> snap_build(mpl::false_, const Node& n, const snap_holder<Node>* old);
+
+template< typename Node, typename... Children, std::size_t... Is >
+snap_holder<Node> snap_build_children(const Node& n, const snap_holder<Node>* old,
+	type_list<Children...>, std::index_sequence<Is...>)
+{
+	auto next = std::make_shared< snap_node<Node> >();
+	((std::get<Is>(next->kids) = snap_build(is_leaf<Children>{}, get<Children>(n),
+		old ? &std::get<Is>((*old)->kids) : nullptr)), ...);
+	if (old && (snap_same(std::get<Is>(next->kids), std::get<Is>((*old)->kids)) && ...))
+		return *old;
+	return next;
+}
+
+template< typename Node >
+snap_holder<Node> snap_build(mpl::false_, const Node& n, const snap_holder<Node>* old)
+{
+	using children = typename Node::child_types;
+	return snap_build_children(n, old, children{},
+		std::make_index_sequence< type_list_size<children>::value >{});
+}
+
+// copy the values of a holder into the plain tree node out
+template< typename Leaf >
+void snap_materialize(const Leaf& l, Leaf& out) { out = l; }
+
+template< typename Node, typename... Children, std::size_t... Is >
+void snap_materialize_children(const snap_node<Node>& s, Node& out,
+	type_list<Children...>, std::index_sequence<Is...>)
+{
+	(snap_materialize(std::get<Is>(s.kids), get<Children>(out)), ...);
+}
+
+template< typename Node >
+void snap_materialize(const std::shared_ptr< const snap_node<Node> >& p, Node& out)
+{
+	using children = typename Node::child_types;
+	snap_materialize_children(*p, out, children{},
+		std::make_index_sequence< type_list_size<children>::value >{});
+}
+
+// the node below a holder named by the lookup keys
+template< typename Holder >
+const Holder& snap_path(const Holder& h, type_list<>) { return h; }
+
+template< typename Node, typename Key, typename... Keys >
+decltype(auto) snap_path(const std::shared_ptr< const snap_node<Node> >& p, type_list<Key, Keys...>)
+{
+	using child = typename find_child< Key, typename Node::child_types >::type;
+	constexpr std::size_t i = type_list_index<child>(typename Node::child_types{});
+	return snap_path(std::get<i>(p->kids), type_list<Keys...>{});
+}
+
+// Path copy: a new holder in which f has been applied to the node
+// named by the keys. Only the nodes along the path are copied, a node
+// at the end of the path is rebuilt sharing its unchanged subtrees.
+template< typename Leaf, typename F >
+Leaf snap_update(const Leaf& l, type_list<>, F& f)
+{
+	Leaf next = l;
+	f(next);
+	return next;
+}
+
+template< typename Node, typename F >
+snap_holder<Node> snap_update(const std::shared_ptr< const snap_node<Node> >& p, type_list<>, F& f)
+{
+	Node n;
+	snap_materialize(p, n);
+	f(n);
+	return snap_build(mpl::false_{}, n, &p);
+}
+
+template< typename Node, typename Key, typename... Keys, typename F >
+snap_holder<Node> snap_update(const std::shared_ptr< const snap_node<Node> >& p,
+	type_list<Key, Keys...>, F& f)
+{
+	using child = typename find_child< Key, typename Node::child_types >::type;
+	constexpr std::size_t i = type_list_index<child>(typename Node::child_types{});
+	auto next = std::make_shared< snap_node<Node> >(*p);
+	std::get<i>(next->kids) = snap_update(std::get<i>(p->kids), type_list<Keys...>{}, f);
+	return next;
+}
+
+// Versioned tree with wait free readers and epoch based reclamation
+// * writers publish immutable versions, serialized by a mutex
+// * readers announce the current epoch in a reader slot, then use the
+//   version published at that time for as long as their view lives
+// * a replaced version is freed once no slot announces an epoch at or
+//   before its retirement, subtrees it shares live on in newer versions
+//   (a long lived view therefore holds back every version retired after it)
+// Readers are wait free while there are no more concurrent views than
+// reader slots, beyond that read() probes for a free slot.
+template< typename Tree >
+class SnapshotTree
+{
+	struct published
+	{
+		snap_holder<Tree> root;
+		std::uint64_t number;
+	};
+
+	struct retired
+	{
+		std::unique_ptr<const published> v;
+		std::uint64_t epoch;
+	};
+
+	struct alignas(cache_line_size) reader_slot
+	{
+		std::atomic<std::uint64_t> epoch{ 0 }; // 0 when the slot is free
+	};
+
+public:
+	// a consistent, immutable view of one version
+	class view
+	{
+	public:
+		view(view&& rhs) noexcept : v_(rhs.v_), slot_(rhs.slot_) { rhs.slot_ = nullptr; }
+		view(const view&) = delete;
+		view& operator=(const view&) = delete;
+
+		~view() {
+			if (slot_) slot_->epoch.store(0, std::memory_order_release);
+		}
+
+		std::uint64_t version() const { return v_->number; }
+
+		// the leaf (or snap_node) named by the path Names...
+		template< typename... Names >
+		decltype(auto) get() const {
+			return snap_deref(snap_path(v_->root, type_list< name_key<Names>... >{}));
+		}
+
+		// copy the whole version into a plain tree
+		Tree tree() const {
+			Tree t;
+			snap_materialize(v_->root, t);
+			return t;
+		}
+
+	private:
+		friend class SnapshotTree;
+		view(const published* v, reader_slot* slot) : v_(v), slot_(slot) {}
+
+		const published* v_;
+		reader_slot* slot_;
+	};
+
+	explicit SnapshotTree(const Tree& init = Tree(),
+		std::size_t readers = std::thread::hardware_concurrency())
+		: slots_(std::max<std::size_t>(readers, 1))
+	{
+		current_.store(new published{ snap_build(mpl::false_{}, init, nullptr), 0 });
+	}
+
+	SnapshotTree(const SnapshotTree&) = delete;
+	SnapshotTree& operator=(const SnapshotTree&) = delete;
+
+	// must not run concurrently with any reader or writer
+	~SnapshotTree() {
+		delete current_.load();
+	}
+
+	view read() const {
+		const std::size_t n = slots_.size();
+		for (std::size_t k = thread_slot();; ++k) {
+			reader_slot& s = slots_[k % n];
+			std::uint64_t idle = 0;
+			if (s.epoch.compare_exchange_strong(idle, epoch_.load()))
+				return view(current_.load(), &s);
+		}
+	}
+
+	// publish t as a new version, sharing every subtree equal to the current one
+	std::uint64_t publish(const Tree& t) {
+		std::lock_guard<std::mutex> lock(write_mutex_);
+		const published* v = current_.load();
+		return replace(snap_build(mpl::false_{}, t, &v->root), v);
+	}
+
+	// publish a new version in which f(node) has been applied to the node
+	// named by the path Names..., copying only the nodes along the path
+	template< typename... Names, typename F >
+	std::uint64_t update(F f) {
+		std::lock_guard<std::mutex> lock(write_mutex_);
+		const published* v = current_.load();
+		return replace(snap_update(v->root, type_list< name_key<Names>... >{}, f), v);
+	}
+
+	// free every retired version no reader can still see
+	void reclaim() {
+		std::lock_guard<std::mutex> lock(write_mutex_);
+		reclaim_locked();
+	}
+
+	std::size_t retired_count() const {
+		std::lock_guard<std::mutex> lock(write_mutex_);
+		return retired_.size();
+	}
+
+private:
+	std::uint64_t replace(snap_holder<Tree> root, const published* old) {
+		const std::uint64_t number = old->number + 1;
+		current_.store(new published{ std::move(root), number });
+		// readers announcing an epoch past this one load the new version
+		retired_.push_back({ std::unique_ptr<const published>(old), epoch_.fetch_add(1) });
+		reclaim_locked();
+		return number;
+	}
+
+	void reclaim_locked() {
+		std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+		for (const reader_slot& s : slots_) {
+			const std::uint64_t e = s.epoch.load();
+			if (e != 0) oldest = std::min(oldest, e);
+		}
+		retired_.erase(std::remove_if(retired_.begin(), retired_.end(),
+			[oldest](const retired& r) { return r.epoch < oldest; }), retired_.end());
+	}
+
+	static std::size_t thread_slot() {
+		static std::atomic<std::size_t> next{ 0 };
+		thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+		return slot;
+	}
+
+	std::atomic<const published*> current_{ nullptr };
+	std::atomic<std::uint64_t> epoch_{ 1 };
+	mutable std::vector<reader_slot> slots_;
+	mutable std::mutex write_mutex_;
+	std::vector<retired> retired_;
+};
+
+// ******************************************************************
+// BATCHED COUNTER BASED RANDOM INITIALIZATION
+// ******************************************************************
+
+// Philox4x32-10 counter based generator (Salmon et al., SC'11)
+// The output is a pure function of (counter, key), so any element of a
+// stream can be generated independently and in any order.
+inline std::array<std::uint32_t, 4> philox4x32(std::array<std::uint32_t, 4> ctr,
+	std::array<std::uint32_t, 2> key)
+{
+	for (int round = 0; round < 10; ++round) {
+		const std::uint64_t p0 = std::uint64_t(0xD2511F53u) * ctr[0];
+		const std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * ctr[2];
+		ctr = { std::uint32_t(p1 >> 32) ^ ctr[1] ^ key[0], std::uint32_t(p1),
+			std::uint32_t(p0 >> 32) ^ ctr[3] ^ key[1], std::uint32_t(p0) };
+		key[0] += 0x9E3779B9u;
+		key[1] += 0xBB67AE85u;
+	}
+	return ctr;
+}
+
+// normals generated per chunk, a multiple of the 4 normals per philox block
+constexpr std::size_t rand_gen_chunk = 256;
+
+// fill u with the rand_gen_chunk uniform 32 bit words of stream from
+// element begin (a multiple of 4) on, the same words as philox4x32.
+// The blocks of a chunk are lanes: every round is one loop across all of
+// them, which vectorizes the 32 x 32 -> 64 bit multiplies.
+inline void philox_chunk(std::uint32_t* u, std::size_t begin, std::uint32_t stream,
+	std::array<std::uint32_t, 2> key)
+{
+	constexpr std::size_t blocks = rand_gen_chunk / 4;
+	std::uint32_t c0[blocks], c1[blocks], c2[blocks], c3[blocks];
+	for (std::size_t b = 0; b < blocks; ++b) {
+		const std::uint64_t block = begin / 4 + b;
+		c0[b] = std::uint32_t(block);
+		c1[b] = std::uint32_t(block >> 32);
+		c2[b] = stream;
+		c3[b] = 0;
+	}
+
+	for (int round = 0; round < 10; ++round) {
+		for (std::size_t b = 0; b < blocks; ++b) {
+			const std::uint64_t p0 = std::uint64_t(0xD2511F53u) * c0[b];
+			const std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * c2[b];
+			c0[b] = std::uint32_t(p1 >> 32) ^ c1[b] ^ key[0];
+			c2[b] = std::uint32_t(p0 >> 32) ^ c3[b] ^ key[1];
+			c1[b] = std::uint32_t(p1);
+			c3[b] = std::uint32_t(p0);
+		}
+		key[0] += 0x9E3779B9u;
+		key[1] += 0xBB67AE85u;
+	}
+
+	for (std::size_t b = 0; b < blocks; ++b) {
+		u[4 * b] = c0[b];
+		u[4 * b + 1] = c1[b];
+		u[4 * b + 2] = c2[b];
+		u[4 * b + 3] = c3[b];
+	}
+}
+
+// Lane friendly math for the Box-Muller transform: no branches, no errno
+// and no calls, so that a loop over a chunk vectorizes. Accurate to a
+// few ulp over the inputs Box-Muller feeds them.
+template< typename To, typename From >
+To lane_bit_cast(From v)
+{
+	static_assert(sizeof(To) == sizeof(From), "lane_bit_cast needs equally sized types");
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_bit_cast(To, v);
+#else
+	To r;
+	std::memcpy(&r, &v, sizeof(r));
+	return r;
+#endif
+}
+
+// natural log of x in [2^-1000, 1], x = m 2^e with m in [sqrt(1/2), sqrt(2))
+// and log(m) = 2 atanh(f) for f = (m - 1) / (m + 1), |f| < 0.172
+inline double lane_log(double x)
+{
+	constexpr std::uint64_t bias = std::uint64_t(1024) << 52;
+	const std::uint64_t bits = lane_bit_cast<std::uint64_t>(x);
+	const std::uint64_t eb = (bits - 0x3fe6a09e667f3bcdull + bias) >> 52; // e + 1024
+	const double m = lane_bit_cast<double>(bits - (eb << 52) + bias);
+	const double e = lane_bit_cast<double>(eb | 0x4330000000000000ull) - (4503599627370496.0 + 1024);
+	const double f = (m - 1) / (m + 1), f2 = f * f;
+	double s = 2.0 / 19;
+	s = s * f2 + 2.0 / 17;
+	s = s * f2 + 2.0 / 15;
+	s = s * f2 + 2.0 / 13;
+	s = s * f2 + 2.0 / 11;
+	s = s * f2 + 2.0 / 9;
+	s = s * f2 + 2.0 / 7;
+	s = s * f2 + 2.0 / 5;
+	s = s * f2 + 2.0 / 3;
+	s = s * f2 + 2.0;
+	return e * 0.6931471805599453 + f * s;
+}
+
+// square root of x > 0, four Newton steps on the reciprocal square root
+inline double lane_sqrt(double x)
+{
+	double y = lane_bit_cast<double>(0x5fe6eb50c7b537a9ull - (lane_bit_cast<std::uint64_t>(x) >> 1));
+	const double h = 0.5 * x;
+	y = y * (1.5 - h * y * y);
+	y = y * (1.5 - h * y * y);
+	y = y * (1.5 - h * y * y);
+	y = y * (1.5 - h * y * y);
+	return x * y;
+}
+
+// sin and cos of 2 pi u for u in [0, 1), reduced to [-pi/4, pi/4] by quadrant
+inline void lane_sincos_2pi(double u, double& sn, double& cs)
+{
+	const int k = int(u * 4 + 0.5);
+	const double x = 6.283185307179586 * (u - 0.25 * k), x2 = x * x;
+	double s = -1.0 / 1307674368000;
+	s = s * x2 + 1.0 / 6227020800;
+	s = s * x2 - 1.0 / 39916800;
+	s = s * x2 + 1.0 / 362880;
+	s = s * x2 - 1.0 / 5040;
+	s = s * x2 + 1.0 / 120;
+	s = s * x2 - 1.0 / 6;
+	s = s * x2 * x + x;
+	double c = 1.0 / 87178291200;
+	c = c * x2 - 1.0 / 479001600;
+	c = c * x2 + 1.0 / 3628800;
+	c = c * x2 - 1.0 / 40320;
+	c = c * x2 + 1.0 / 720;
+	c = c * x2 - 1.0 / 24;
+	c = c * x2 + 0.5;
+	c = 1 - c * x2;
+	const double ks = (k & 1) ? c : s, kc = (k & 1) ? s : c;
+	sn = (k & 2) ? -ks : ks;
+	cs = ((k + 1) & 2) ? -kc : kc;
+}
+
+// call store(i, u) with the uniform 32 bit word u of element i of stream
+// `stream` for every i in [first, last)
+template< typename Store >
+void philox_uniforms(std::uint64_t seed, std::uint32_t stream,
+	std::size_t first, std::size_t last, Store store)
+{
+	const std::array<std::uint32_t, 2> key =
+		{ std::uint32_t(seed), std::uint32_t(seed >> 32) };
+	std::uint32_t u[rand_gen_chunk];
+
+	for (std::size_t begin = first / 4 * 4; begin < last; begin += rand_gen_chunk) {
+		philox_chunk(u, begin, stream, key);
+		const std::size_t lo = std::max(begin, first);
+		const std::size_t hi = std::min(begin + rand_gen_chunk, last);
+		for (std::size_t i = lo; i < hi; ++i) store(i, u[i - begin]);
+	}
+}
+
+// call store(i, z) with the standard normal z of element i of stream
+// `stream` for every i in [first, last)
+// Element i only depends on (seed, stream, i), making the output
+// reproducible regardless of how the range is split across threads.
+// Each chunk is generated in separate uniform and Box-Muller loops, over
+// lanes of fixed width arrays and free of branches and calls, so that
+// both auto-vectorize.
+template< typename Store >
+void philox_normals(std::uint64_t seed, std::uint32_t stream,
+	std::size_t first, std::size_t last, Store store)
+{
+	const std::array<std::uint32_t, 2> key =
+		{ std::uint32_t(seed), std::uint32_t(seed >> 32) };
+	constexpr std::size_t pairs = rand_gen_chunk / 2;
+	std::uint32_t u[rand_gen_chunk];
+	double r[pairs], sn[pairs], cs[pairs];
+	double z[rand_gen_chunk];
+
+	for (std::size_t begin = first / 4 * 4; begin < last; begin += rand_gen_chunk) {
+		philox_chunk(u, begin, stream, key);
+
+		// Box-Muller, mapping each pair of uniforms in (0, 1) to two normals
+		for (std::size_t p = 0; p < pairs; ++p) {
+			const double u1 = (u[2 * p] + 0.5) * (1.0 / 4294967296.0);
+			const double u2 = (u[2 * p + 1] + 0.5) * (1.0 / 4294967296.0);
+			r[p] = lane_sqrt(-2.0 * lane_log(u1));
+			lane_sincos_2pi(u2, sn[p], cs[p]);
+		}
+		for (std::size_t p = 0; p < pairs; ++p) {
+			z[2 * p] = r[p] * cs[p];
+			z[2 * p + 1] = r[p] * sn[p];
+		}
+
+		const std::size_t lo = std::max(begin, first);
+		const std::size_t hi = std::min(begin + rand_gen_chunk, last);
+		for (std::size_t i = lo; i < hi; ++i) store(i, z[i - begin]);
+	}
+}
+
+// Assign the rand_gen value of element i of stream `stream` to at(i), a
+// T&, for every i in [first, last). Every kind of leaf gets the
+// distribution of leaf_kernel_rand_gen, picked by the same kernel tags:
+// * integers are uniform within rand_int_bounds (32 bits of resolution)
+// * std::array<E, N> draws element j of row i as element i * N + j
+// * anything else is normal
+template< typename T, typename At >
+void philox_fill(std::uint64_t seed, std::uint32_t stream, std::size_t first, std::size_t last,
+	double mean, double stddev, At at, kernel_integral)
+{
+	const auto bounds = rand_int_bounds<T>(mean, stddev);
+	using W = typename decltype(bounds)::first_type;
+	const double span = double(bounds.second) - double(bounds.first) + 1;
+	philox_uniforms(seed, stream, first, last, [=](std::size_t i, std::uint32_t u) {
+		const double x = std::floor(span * (u * (1.0 / 4294967296.0)));
+		const W v = x >= span - 1 ? bounds.second : W(bounds.first + W(x));
+		at(i) = static_cast<T>(v);
+	});
+}
+
+template< typename T, typename At >
+void philox_fill(std::uint64_t seed, std::uint32_t stream, std::size_t first, std::size_t last,
+	double mean, double stddev, At at, kernel_array)
+{
+	using E = typename T::value_type;
+	constexpr std::size_t N = std::tuple_size<T>::value;
+	philox_fill<E>(seed, stream, first * N, last * N, mean, stddev,
+		[at](std::size_t k) -> E& { return at(k / N)[k % N]; },
+		typename leaf_kernel_kind<E>::type{});
+}
+
+template< typename T, typename At, typename Kind >
+void philox_fill(std::uint64_t seed, std::uint32_t stream, std::size_t first, std::size_t last,
+	double mean, double stddev, At at, Kind)
+{
+	philox_normals(seed, stream, first, last, [=](std::size_t i, double z) {
+		at(i) = static_cast<T>(mean + stddev * z);
+	});
+}
+
+template< typename T, typename At >
+void philox_fill(std::uint64_t seed, std::uint32_t stream, std::size_t first, std::size_t last,
+	double mean, double stddev, At at)
+{
+	philox_fill<T>(seed, stream, first, last, mean, stddev, at, typename leaf_kernel_kind<T>::type{});
+}
+
+// fill rows [first, last) of every column of a soa_node
+// every leaf uses its own stream, numbered in scan order
+struct soa_rand_gen_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, std::uint64_t seed, std::size_t first, std::size_t last,
+		std::uint32_t& stream)
+	{
+		apply_impl(is_leaf<typename Child::node_type>{}, get<Child>(a), seed, first, last, stream);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, Child& c, std::uint64_t seed, std::size_t first,
+		std::size_t last, std::uint32_t& stream)
+	{
+		using leaf = typename Child::node_type;
+		using T = typename leaf::value_type;
+		T* col = c.col.data();
+		philox_fill<T>(seed, stream++, first, last,
+			rand_gen_params<leaf>::mean, rand_gen_params<leaf>::stddev,
+			[col](std::size_t i) -> T& { return col[i]; });
+	}
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, Child& c, std::uint64_t seed, std::size_t first,
+		std::size_t last, std::uint32_t& stream)
+	{
+		inher_tree_scan< soa_rand_gen_f >(c, seed, first, last, stream);
+	}
+};
+
+// fill leaf values of an array of trees, see expr_assign_f for Proj
+struct batch_rand_gen_f
+{
+	template<typename Parent, typename Child, typename Tree, typename Proj>
+	static void apply(Parent& p, Tree* trees, std::size_t n, std::uint64_t seed,
+		std::uint32_t& stream, Proj proj)
+	{
+		auto child_proj = [proj](auto& t) -> decltype(auto) {
+			return get<Child>(proj(t));
+		};
+		apply_impl<Child>(is_leaf<Child>{}, get<Child>(p), trees, n, seed, stream, child_proj);
+	}
+
+private:
+	template<typename Child, typename Tree, typename Proj>
+	static void apply_impl(mpl::true_, Child&, Tree* trees, std::size_t n, std::uint64_t seed,
+		std::uint32_t& stream, Proj proj)
+	{
+		using T = typename Child::value_type;
+		philox_fill<T>(seed, stream++, 0, n,
+			rand_gen_params<Child>::mean, rand_gen_params<Child>::stddev,
+			[trees, proj](std::size_t i) -> T& { return proj(trees[i]).val; });
+	}
+
+	template<typename Child, typename Tree, typename Proj>
+	static void apply_impl(mpl::false_, Child& c, Tree* trees, std::size_t n, std::uint64_t seed,
+		std::uint32_t& stream, Proj proj)
+	{
+		inher_tree_scan< batch_rand_gen_f >(c, trees, n, seed, stream, proj);
+	}
+};
+
+// randomly initialize rows [first, last) of a batch of trees
+template<typename Tree>
+void batch_rand_gen(TreeSoA<Tree>& soa, std::uint64_t seed, std::size_t first, std::size_t last)
+{
+	std::uint32_t stream = 0;
+	inher_tree_scan< soa_rand_gen_f >(soa, seed, first, last, stream);
+}
+
+template<typename Tree>
+void batch_rand_gen(TreeSoA<Tree>& soa, std::uint64_t seed)
+{
+	batch_rand_gen(soa, seed, 0, soa.size());
+}
+
+// randomly initialize a batch of trees, splitting the rows across threads
+// the result is identical to the single threaded version
+template<typename Tree>
+void batch_rand_gen(parallel_scan_t, TreeSoA<Tree>& soa, std::uint64_t seed)
+{
+	const std::size_t n = soa.size();
+	const std::size_t tasks = std::max(1u, std::thread::hardware_concurrency());
+	const std::size_t rows = (n / tasks + rand_gen_chunk) / rand_gen_chunk * rand_gen_chunk;
+
+	std::vector< std::future<void> > futures;
+	for (std::size_t first = 0; first < n; first += rows)
+		futures.push_back(std::async(std::launch::async, [&soa, seed, first, rows, n] {
+			batch_rand_gen(soa, seed, first, std::min(first + rows, n));
+		}));
+	for (auto& f : futures) f.get();
+}
+
+// randomly initialize an array of n trees, producing the same values as
+// the TreeSoA version for the same seed
+template<typename Tree>
+void batch_rand_gen(Tree* trees, std::size_t n, std::uint64_t seed)
+{
+	if (n == 0) return;
+	std::uint32_t stream = 0;
+	auto root = [](auto& t) -> decltype(auto) { return t; };
+	inher_tree_scan< batch_rand_gen_f >(trees[0], trees, n, seed, stream, root);
+}
+
+// ******************************************************************
+// TREE REDUCTIONS
+// ******************************************************************
+
+template< typename T >
+struct reduce_accum_of { using type = typename reduce_accum<T>::type; };
+
+template< typename T >
+struct reduce_mean_of { using type = double; };
+
+// a tree shaped like Tree holding the widened sum of every leaf
+template< typename Tree >
+using sum_tree = typename rebind_leaves< Tree, reduce_accum_of >::type;
+
+// a tree shaped like Tree holding the mean of every leaf
+template< typename Tree >
+using mean_tree = typename rebind_leaves< Tree, reduce_mean_of >::type;
+
+// horizontal reduction of the leaves of a single tree into acc
+template< typename Op >
+struct reduce_leaves_f
+{
+	template<typename Parent, typename Child, typename Acc>
+	static void apply(Parent& a, Acc& acc) {
+		apply_impl(is_leaf<Child>{}, get<Child>(a), acc);
+	}
+
+private:
+	template<typename Child, typename Acc>
+	static void apply_impl(mpl::true_, const Child& c, Acc& acc) {
+		leaf_reduce<Op>(acc, c.val);
+	}
+
+	template<typename Child, typename Acc>
+	static void apply_impl(mpl::false_, const Child& c, Acc& acc) {
+		inher_tree_scan< reduce_leaves_f<Op> >(c, acc);
+	}
+};
+
+// dot product of two trees, every product is formed in the widened type
+// of its leaf (e.g. int * int in 64 bits) before it is accumulated
+struct reduce_dot_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, Parent& b, double& acc) {
+		apply_impl(is_leaf<Child>{}, get<Child>(a), get<Child>(b), acc);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, const Child& a, const Child& b, double& acc) {
+		leaf_dot(acc, a.val, b.val);
+	}
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, const Child& a, const Child& b, double& acc) {
+		inher_tree_scan< reduce_dot_f >(a, b, acc);
+	}
+};
+
+template< typename Op, typename Tree, typename Acc >
+Acc tree_reduce(const Tree& t, Acc init)
+{
+	inher_tree_scan< reduce_leaves_f<Op> >(t, init);
+	return init;
+}
+
+template< typename Tree >
+double tree_sum(const Tree& t) { return tree_reduce<reduce_sum>(t, 0.0); }
+
+template< typename Tree >
+double tree_min(const Tree& t) {
+	return tree_reduce<reduce_min>(t, std::numeric_limits<double>::infinity());
+}
+
+template< typename Tree >
+double tree_max(const Tree& t) {
+	return tree_reduce<reduce_max>(t, -std::numeric_limits<double>::infinity());
+}
+
+template< typename Tree >
+double tree_dot(const Tree& a, const Tree& b)
+{
+	double acc = 0;
+	inher_tree_scan< reduce_dot_f >(a, b, acc);
+	return acc;
+}
+
+// the L2 norm over all leaves
+template< typename Tree >
+double tree_norm(const Tree& t) { return std::sqrt(tree_dot(t, t)); }
+
+// elements summed directly (in 8 independent, vectorizable lanes) before
+// switching to pairwise summation, and rows per task of the batch sums
+constexpr std::size_t reduce_block = 256;
+constexpr std::size_t reduce_chunk = std::size_t(1) << 16;
+
+// Pairwise summation: the error grows with O(log n) instead of O(n),
+// while the unrolled base case keeps the loop vectorizable. (Kahan
+// summation is as accurate but serializes the loop.) Values enter
+// through leaf_reduce, so std::array values add all their elements.
+template< typename A, typename T >
+A pairwise_sum(const T* x, std::size_t n)
+{
+	if (n > reduce_block) {
+		const std::size_t half = n / 2;
+		return pairwise_sum<A>(x, half) + pairwise_sum<A>(x + half, n - half);
+	}
+
+	A lane[8] = {};
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		for (std::size_t k = 0; k < 8; ++k) leaf_reduce<reduce_sum>(lane[k], x[i + k]);
+	A tail = 0;
+	for (; i < n; ++i) leaf_reduce<reduce_sum>(tail, x[i]);
+	return ((lane[0] + lane[1]) + (lane[2] + lane[3])) +
+		((lane[4] + lane[5]) + (lane[6] + lane[7])) + tail;
+}
+
+// Sum of a column, computed as the pairwise sum of the sums of its
+// reduce_chunk sized chunks. The chunks are independent of the number of
+// threads, so the serial and parallel results are bit identical.
+template< typename A, typename T >
+A column_sum(const T* x, std::size_t n, bool parallel)
+{
+	const std::size_t chunks = (n + reduce_chunk - 1) / reduce_chunk;
+	std::vector<A> partial(chunks);
+	auto sum_chunks = [&](std::size_t first, std::size_t last) {
+		for (std::size_t c = first; c < last; ++c)
+			partial[c] = pairwise_sum<A>(x + c * reduce_chunk,
+				std::min(reduce_chunk, n - c * reduce_chunk));
+	};
+
+	const std::size_t tasks = parallel
+		? std::min<std::size_t>(chunks, std::max(1u, std::thread::hardware_concurrency())) : 1;
+	if (tasks <= 1) {
+		sum_chunks(0, chunks);
+	} else {
+		std::vector< std::future<void> > futures;
+		const std::size_t per_task = (chunks + tasks - 1) / tasks;
+		for (std::size_t first = 0; first < chunks; first += per_task)
+			futures.push_back(std::async(std::launch::async, sum_chunks,
+				first, std::min(first + per_task, chunks)));
+		for (auto& f : futures) f.get();
+	}
+	return pairwise_sum<A>(partial.data(), partial.size());
+}
+
+// per leaf sums (or means) of a batch of trees, one column at a time
+// the result tree is Tree with its leaf value types mapped by F
+template< template<typename> class F, bool Mean >
+struct soa_sum_f
+{
+	template<typename Parent, typename Child, typename Result>
+	static void apply(Parent& a, Result& r, std::size_t n, bool parallel) {
+		using result_child = typename rebind_leaves< typename Child::node_type, F >::type;
+		apply_impl(is_leaf<typename Child::node_type>{}, get<Child>(a),
+			get<result_child>(r), n, parallel);
+	}
+
+private:
+	template<typename Child, typename Leaf>
+	static void apply_impl(mpl::true_, const Child& c, Leaf& r, std::size_t n, bool parallel) {
+		using A = typename reduce_accum< typename Child::node_type::value_type >::type;
+		const A sum = column_sum<A>(c.col.data(), n, parallel);
+		using R = typename Leaf::value_type;
+		r.val = Mean ? static_cast<R>(n ? static_cast<double>(sum) / n : 0.0) : static_cast<R>(sum);
+	}
+
+	template<typename Child, typename Node>
+	static void apply_impl(mpl::false_, const Child& c, Node& r, std::size_t n, bool parallel) {
+		inher_tree_scan< soa_sum_f >(c, r, n, parallel);
+	}
+};
+
+// per leaf sum over a batch of trees, accumulated in the widened leaf types
+template< typename Tree >
+sum_tree<Tree> batch_sum(const TreeSoA<Tree>& soa)
+{
+	sum_tree<Tree> r;
+	inher_tree_scan< soa_sum_f<reduce_accum_of, false> >(soa, r, soa.size(), false);
+	return r;
+}
+
+template< typename Tree >
+sum_tree<Tree> batch_sum(parallel_scan_t, const TreeSoA<Tree>& soa)
+{
+	sum_tree<Tree> r;
+	inher_tree_scan< soa_sum_f<reduce_accum_of, false> >(soa, r, soa.size(), true);
+	return r;
+}
+
+// per leaf mean over a batch of trees
+template< typename Tree >
+mean_tree<Tree> batch_mean(const TreeSoA<Tree>& soa)
+{
+	mean_tree<Tree> r;
+	inher_tree_scan< soa_sum_f<reduce_mean_of, true> >(soa, r, soa.size(), false);
+	return r;
+}
+
+template< typename Tree >
+mean_tree<Tree> batch_mean(parallel_scan_t, const TreeSoA<Tree>& soa)
+{
+	mean_tree<Tree> r;
+	inher_tree_scan< soa_sum_f<reduce_mean_of, true> >(soa, r, soa.size(), true);
+	return r;
+}
+
+// ******************************************************************
+// DEVICE OFFLOAD OF TREE BATCHES
+// ******************************************************************
+
+// In order queue of work executed by a single worker thread, the host
+// stand in for a device stream. The first exception thrown by a task is
+// kept and rethrown by synchronize, later tasks still run.
+class host_stream
+{
+public:
+	host_stream() : worker_([this] { run(); }) {}
+
+	host_stream(const host_stream&) = delete;
+	host_stream& operator=(const host_stream&) = delete;
+
+	~host_stream() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_ = true;
+		}
+		work_.notify_all();
+		worker_.join();
+	}
+
+	void enqueue(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			tasks_.push_back(std::move(task));
+		}
+		work_.notify_all();
+	}
+
+	// block until every task enqueued so far has run
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		idle_.wait(lock, [&] { return tasks_.empty() && !busy_; });
+	}
+
+	void synchronize() {
+		wait();
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+	}
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (;;) {
+			work_.wait(lock, [&] { return done_ || !tasks_.empty(); });
+			if (tasks_.empty()) return;
+			std::function<void()> task = std::move(tasks_.front());
+			tasks_.pop_front();
+			busy_ = true;
+			lock.unlock();
+			try { task(); }
+			catch (...) {
+				lock.lock();
+				if (!error_) error_ = std::current_exception();
+				lock.unlock();
+			}
+			lock.lock();
+			busy_ = false;
+			idle_.notify_all();
+		}
+	}
+
+	std::mutex mutex_;
+	std::condition_variable work_;
+	std::condition_variable idle_;
+	std::deque< std::function<void()> > tasks_;
+	std::exception_ptr error_;
+	bool busy_ = false;
+	bool done_ = false;
+	std::thread worker_;
+};
+
+// A device backend provides, as static members
+// * stream, an in order queue of transfers and kernels
+// * alloc/free for device memory, pinned_alloc/pinned_free for page
+//   locked host memory that asynchronous copies can read and write
+// * copy(dst, src, bytes, s), an asynchronous copy in either direction
+// * host_task(s, f), running f on the host once the preceding work is done
+// * synchronize(s), which rethrows errors, and wait(s), which does not
+// * event, record(s) marking the work enqueued on s so far, and
+//   wait_event(s, e) holding back work enqueued on s afterwards until e
+//   has completed, without blocking the host
+// * the kernels add_eq, rand_gen and sum over a column of n rows,
+//   add_eq and rand_gen honour the leaf_add_policy and rand_gen_params
+//   of the leaf they are given
+// A CUDA, HIP or SYCL backend maps these onto its streams (or queues),
+// cudaMallocHost style allocations and a grid stride kernel per function.
+// host_backend is the reference implementation, running every kernel on
+// the stream's worker thread with the same code as the TreeSoA paths.
+struct host_backend
+{
+	using stream = host_stream;
+
+	static void* alloc(std::size_t bytes) { return ::operator new(bytes, std::align_val_t(64)); }
+	static void free(void* p) { ::operator delete(p, std::align_val_t(64)); }
+	static void* pinned_alloc(std::size_t bytes) { return alloc(bytes); }
+	static void pinned_free(void* p) { free(p); }
+
+	static void copy(void* dst, const void* src, std::size_t bytes, stream& s) {
+		s.enqueue([=] { std::memcpy(dst, src, bytes); });
+	}
+
+	template<typename F>
+	static void host_task(stream& s, F f) { s.enqueue(std::move(f)); }
+
+	static void synchronize(stream& s) { s.synchronize(); }
+	static void wait(stream& s) { s.wait(); }
+
+	using event = std::shared_future<void>;
+
+	static event record(stream& s) {
+		auto done = std::make_shared< std::promise<void> >();
+		event e = done->get_future().share();
+		s.enqueue([done] { done->set_value(); });
+		return e;
+	}
+
+	static void wait_event(stream& s, event e) { s.enqueue([e] { e.wait(); }); }
+
+	template<typename Leaf, typename T>
+	static void add_eq(T* dst, const T* src, std::size_t n, stream& s) {
+		s.enqueue([=] { column_add_eq<Leaf>(dst, src, n); });
+	}
+
+	// row i of col receives element first + i of the philox stream id
+	template<typename Leaf, typename T>
+	static void rand_gen(T* col, std::size_t n, std::uint64_t seed, std::size_t first,
+		std::uint32_t id, stream& s)
+	{
+		s.enqueue([=] {
+			philox_fill<T>(seed, id, first, first + n,
+				rand_gen_params<Leaf>::mean, rand_gen_params<Leaf>::stddev,
+				[col, first](std::size_t i) -> T& { return col[i - first]; });
+		});
+	}
+
+	// out must be pinned (host visible) memory
+	template<typename A, typename T>
+	static void sum(const T* col, std::size_t n, A* out, stream& s) {
+		s.enqueue([=] { *out = column_sum<A>(col, n, false); });
+	}
+};
+
+// Device mirror of an inheritance tree with one device column per leaf,
+// each backed by a pinned staging column of the same size. Like soa_node
+// it defines its own base_type, so inher_tree_scan and functors such as
+// add_eq walk it unchanged; leaf operations enqueue kernels instead.
+template<typename Node, typename Backend>
+struct device_node;
+
+template<typename Name, typename... ChildNodes, typename Backend>
+struct device_node< InternalNode<Name, ChildNodes...>, Backend >
+	: device_node<ChildNodes, Backend>...
+{
+	using name = Name;
+	using node_type = InternalNode<Name, ChildNodes...>;
+	using base_type = mpl::vector< device_node<ChildNodes, Backend>... >;
+	using child_types = type_list< device_node<ChildNodes, Backend>... >;
+
+	device_node& operator+=(const device_node& rhs) {
+		inher_tree_scan< add_eq >(*this, rhs);
+		return *this;
+	}
+};
+
+template<typename Name, typename T, typename Backend>
+struct device_node< LeafNode<Name, T>, Backend >
+{
+	using name = Name;
+	using node_type = LeafNode<Name, T>;
+
+	device_node() = default;
+	device_node(const device_node&) = delete;
+	device_node& operator=(const device_node&) = delete;
+
+	~device_node() {
+		if (col) Backend::free(col);
+		if (staging) Backend::pinned_free(staging);
+	}
+
+	void allocate(std::size_t capacity, typename Backend::stream& s) {
+		col = static_cast<T*>(Backend::alloc(std::max<std::size_t>(capacity, 1) * sizeof(T)));
+		staging = static_cast<T*>(Backend::pinned_alloc(std::max<std::size_t>(capacity, 1) * sizeof(T)));
+		stream = &s;
+	}
+
+	// a single kernel over the active rows
+	device_node& operator+=(const device_node& rhs) {
+		Backend::template add_eq<node_type>(col, rhs.col, n, *stream);
+		return *this;
+	}
+
+	T* col = nullptr;
+	T* staging = nullptr;
+	std::size_t n = 0;
+	typename Backend::stream* stream = nullptr;
+};
+
+// apply to every leaf of a device mirror, Op::leaf(leaf, params...)
+template<typename Op>
+struct device_leaf_f
+{
+	template<typename Parent, typename Child, typename... Params>
+	static void apply(Parent& p, Params&&... ps) {
+		apply_impl(is_leaf<typename Child::node_type>{}, get<Child>(p), ps...);
+	}
+
+private:
+	template<typename Child, typename... Params>
+	static void apply_impl(mpl::true_, Child& c, Params&... ps) { Op::leaf(c, ps...); }
+
+	template<typename Child, typename... Params>
+	static void apply_impl(mpl::false_, Child& c, Params&... ps) {
+		inher_tree_scan< device_leaf_f >(c, ps...);
+	}
+};
+
+struct device_allocate_op
+{
+	template<typename Leaf, typename Stream>
+	static void leaf(Leaf& l, std::size_t capacity, Stream& s) { l.allocate(capacity, s); }
+};
+
+struct device_rows_op
+{
+	template<typename Leaf>
+	static void leaf(Leaf& l, std::size_t rows) { l.n = rows; }
+};
+
+// host column rows [first, first + n) -> staging -> device
+struct device_upload_op
+{
+	template<typename Leaf, typename Host, typename Backend>
+	static void leaf(Leaf& l, const Host& host, std::size_t first, Backend) {
+		using T = typename Leaf::node_type::value_type;
+		const T* src = get< soa_node<typename Leaf::node_type> >(host).col.data() + first;
+		T* staging = l.staging;
+		const std::size_t bytes = l.n * sizeof(T);
+		Backend::host_task(*l.stream, [=] { std::memcpy(staging, src, bytes); });
+		Backend::copy(l.col, staging, bytes, *l.stream);
+	}
+};
+
+// device -> staging -> host column rows [first, first + n)
+struct device_download_op
+{
+	template<typename Leaf, typename Host, typename Backend>
+	static void leaf(Leaf& l, Host& host, std::size_t first, Backend) {
+		using T = typename Leaf::node_type::value_type;
+		T* dst = get< soa_node<typename Leaf::node_type> >(host).col.data() + first;
+		T* staging = l.staging;
+		const std::size_t bytes = l.n * sizeof(T);
+		Backend::copy(staging, l.col, bytes, *l.stream);
+		Backend::host_task(*l.stream, [=] { std::memcpy(dst, staging, bytes); });
+	}
+};
+
+// every leaf uses its own philox stream numbered in scan order, see soa_rand_gen_f
+struct device_rand_gen_op
+{
+	template<typename Leaf, typename Backend>
+	static void leaf(Leaf& l, std::uint64_t seed, std::size_t first, std::uint32_t& id, Backend) {
+		Backend::template rand_gen<typename Leaf::node_type>(l.col, l.n, seed, first, id++, *l.stream);
+	}
+};
+
+struct device_sum_op
+{
+	template<typename Leaf, typename Result, typename Backend>
+	static void leaf(Leaf& l, Result& r, Backend) {
+		using leaf_type = typename Leaf::node_type;
+		using result_leaf = typename rebind_leaves< leaf_type, reduce_accum_of >::type;
+		using A = typename result_leaf::value_type;
+		Backend::template sum<A>(l.col, l.n, &get<result_leaf>(r).val, *l.stream);
+	}
+};
+
+// A batch of trees mirrored in device memory and bound to one stream
+// * every operation is asynchronous and ordered on the stream; the host
+//   batch passed to upload and download must live until synchronize
+// * upload / download stage each column through pinned memory
+// * rand_gen produces the same values as batch_rand_gen on the host
+// * += reuses add_eq, one kernel per leaf
+template<typename Tree, typename Backend = host_backend>
+class TreeDevice
+	: public device_node<Tree, Backend>
+{
+public:
+	using stream_type = typename Backend::stream;
+
+	TreeDevice(std::size_t capacity, stream_type& s)
+		: capacity_(capacity), stream_(&s)
+	{
+		inher_tree_scan< device_leaf_f<device_allocate_op> >(*this, capacity, s);
+		result_ = ::new (Backend::pinned_alloc(sizeof(sum_tree<Tree>))) sum_tree<Tree>();
+	}
+
+	TreeDevice(const TreeDevice&) = delete;
+	TreeDevice& operator=(const TreeDevice&) = delete;
+
+	// queued work may still reference the columns, so wait for it
+	~TreeDevice() {
+		Backend::wait(*stream_);
+		Backend::pinned_free(result_);
+	}
+
+	std::size_t capacity() const { return capacity_; }
+	std::size_t size() const { return rows_; }
+	stream_type& stream() const { return *stream_; }
+
+	// set the number of active rows without any transfer
+	void resize(std::size_t rows) {
+		if (rows > capacity_) throw std::length_error("TreeDevice::resize beyond capacity");
+		rows_ = rows;
+		inher_tree_scan< device_leaf_f<device_rows_op> >(*this, rows);
+	}
+
+	// copy host rows [first, first + rows) to the device
+	void upload(const TreeSoA<Tree>& host, std::size_t first, std::size_t rows) {
+		check_host_rows("TreeDevice::upload", host, first, rows);
+		resize(rows);
+		inher_tree_scan< device_leaf_f<device_upload_op> >(*this, host, first, Backend{});
+	}
+
+	void upload(const TreeSoA<Tree>& host) { upload(host, 0, host.size()); }
+
+	// copy the active rows back to host rows [first, first + size())
+	void download(TreeSoA<Tree>& host, std::size_t first = 0) {
+		check_host_rows("TreeDevice::download", host, first, rows_);
+		inher_tree_scan< device_leaf_f<device_download_op> >(*this, host, first, Backend{});
+	}
+
+	// the active rows become rows [first, first + size()) of batch_rand_gen
+	void rand_gen(std::uint64_t seed, std::size_t first = 0) {
+		std::uint32_t id = 0;
+		inher_tree_scan< device_leaf_f<device_rand_gen_op> >(*this, seed, first, id, Backend{});
+	}
+
+	// Runs on the stream of *this. When rhs is bound to another stream the
+	// kernels first wait for the work already enqueued on rhs, and work
+	// enqueued on rhs afterwards waits for the kernels, so neither side
+	// needs to synchronize by hand.
+	TreeDevice& operator+=(const TreeDevice& rhs) {
+		const bool cross = rhs.stream_ != stream_;
+		if (cross) Backend::wait_event(*stream_, Backend::record(*rhs.stream_));
+		device_node<Tree, Backend>::operator+=(rhs);
+		if (cross) Backend::wait_event(*rhs.stream_, Backend::record(*stream_));
+		return *this;
+	}
+
+	// per leaf sums of the active rows, equal to batch_sum; synchronizes
+	sum_tree<Tree> sum() {
+		inher_tree_scan< device_leaf_f<device_sum_op> >(*this, *result_, Backend{});
+		synchronize();
+		return *result_;
+	}
+
+	void synchronize() { Backend::synchronize(*stream_); }
+
+private:
+	// throws unless [first, first + rows) lies within the host batch
+	static void check_host_rows(const char* what, const TreeSoA<Tree>& host,
+		std::size_t first, std::size_t rows)
+	{
+		if (first > host.size() || rows > host.size() - first)
+			throw std::out_of_range(std::string(what) + ": rows [" + std::to_string(first) + ", " +
+				std::to_string(first) + " + " + std::to_string(rows) + ") exceed the host batch of " +
+				std::to_string(host.size()));
+	}
+
+	std::size_t capacity_;
+	std::size_t rows_ = 0;
+	stream_type* stream_;
+	sum_tree<Tree>* result_;
+};
+
+// Run op(device, first_row) over a host batch in chunks of chunk_rows
+// using two device mirrors on two streams, so that the transfers of one
+// chunk overlap the kernels of the other. Chunks are uploaded before and
+// downloaded after op unless disabled.
+template<typename Backend = host_backend, typename Tree, typename Op>
+void offload_chunks(TreeSoA<Tree>& host, std::size_t chunk_rows, Op op,
+	bool upload = true, bool download = true)
+{
+	chunk_rows = std::max<std::size_t>(chunk_rows, 1);
+	typename Backend::stream streams[2];
+	TreeDevice<Tree, Backend> dev0(chunk_rows, streams[0]), dev1(chunk_rows, streams[1]);
+	TreeDevice<Tree, Backend>* dev[2] = { &dev0, &dev1 };
+
+	for (std::size_t first = 0, k = 0; first < host.size(); first += chunk_rows, ++k) {
+		TreeDevice<Tree, Backend>& d = *dev[k % 2];
+		d.synchronize();
+		const std::size_t rows = std::min(chunk_rows, host.size() - first);
+		if (upload) d.upload(host, first, rows);
+		else d.resize(rows);
+		op(d, first);
+		if (download) d.download(host, first);
+	}
+	dev0.synchronize();
+	dev1.synchronize();
+}
+
+// ******************************************************************
+// DISTRIBUTED REDUCTION OF TREES ACROSS RANKS
+// ******************************************************************
+
+// Transports implement the interface below, local_transport is the
+// reference implementation between threads of one process, an MPI or
+// socket transport maps send / recv onto its point to point calls.
+// * rank(), size()
+// * send(dst, tag, data, bytes): may return before the data is delivered,
+//   data can be reused as soon as it returns
+// * recv(src, tag, data, bytes): blocks until the message has arrived
+// Messages between two ranks with the same tag arrive in order.
+
+// in process mailboxes for a group of ranks
+class local_transport_group
+{
+public:
+	explicit local_transport_group(int ranks)
+		: size_(ranks), channels_(std::size_t(ranks) * std::size_t(ranks)) {}
+
+	int size() const { return size_; }
+
+	void send(int src, int dst, int tag, const void* data, std::size_t bytes) {
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		channel& c = channels_[std::size_t(src) * size_ + dst];
+		{
+			std::lock_guard<std::mutex> lock(c.mutex);
+			c.messages.push_back({ tag, std::vector<unsigned char>(p, p + bytes) });
+		}
+		c.ready.notify_all();
+	}
+
+	void recv(int src, int dst, int tag, void* data, std::size_t bytes) {
+		channel& c = channels_[std::size_t(src) * size_ + dst];
+		std::unique_lock<std::mutex> lock(c.mutex);
+		auto match = c.messages.end();
+		c.ready.wait(lock, [&] {
+			match = std::find_if(c.messages.begin(), c.messages.end(),
+				[tag](const message& m) { return m.tag == tag; });
+			return match != c.messages.end();
+		});
+		if (match->bytes.size() != bytes)
+			throw std::runtime_error("local_transport: message size mismatch");
+		if (bytes) std::memcpy(data, match->bytes.data(), bytes);
+		c.messages.erase(match);
+	}
+
+private:
+	struct message
+	{
+		int tag;
+		std::vector<unsigned char> bytes;
+	};
+
+	struct channel
+	{
+		std::mutex mutex;
+		std::condition_variable ready;
+		std::deque<message> messages;
+	};
+
+	int size_;
+	std::vector<channel> channels_;
+};
+
+// the endpoint of one rank of a local_transport_group
+class local_transport
+{
+public:
+	local_transport(local_transport_group& group, int rank) : group_(&group), rank_(rank) {}
+
+	int rank() const { return rank_; }
+	int size() const { return group_->size(); }
+
+	void send(int dst, int tag, const void* data, std::size_t bytes) {
+		group_->send(rank_, dst, tag, data, bytes);
+	}
+
+	void recv(int src, int tag, void* data, std::size_t bytes) {
+		group_->recv(src, rank_, tag, data, bytes);
+	}
+
+private:
+	local_transport_group* group_;
+	int rank_;
+};
+
+struct allreduce_options
+{
+	// payloads of at least this many bytes use the ring algorithm,
+	// smaller ones the binomial tree
+	std::size_t ring_threshold = 64 * 1024;
+};
+
+// A contiguous typed buffer taking part in an allreduce
+// add(dst, src, n) adds n elements of src into dst
+struct allreduce_segment
+{
+	unsigned char* data;
+	std::size_t count;
+	std::size_t size;
+	void (*add)(void*, const void*, std::size_t);
+};
+
+template< typename Leaf >
+void allreduce_add(void* dst, const void* src, std::size_t n)
+{
+	using T = typename Leaf::value_type;
+	column_add_eq<Leaf>(static_cast<T*>(dst), static_cast<const T*>(src), n);
+}
+
+// Sum the segments over all ranks of tr, every rank ends with the sum.
+// prepare(s) is called right before segment s is first needed and
+// finish(s) as soon as it holds the final sum, so that packing and
+// unpacking overlap with the messages of the other segments.
+// * ring: reduce scatter then allgather, every rank sends 2 (P - 1) / P of
+//   the payload, bandwidth optimal for large payloads
+// * binomial tree: reduce to rank 0 then broadcast, 2 log P rounds of
+//   whole messages, latency optimal for small payloads
+template< typename Transport, typename Prepare, typename Finish >
+void allreduce_segments(std::vector<allreduce_segment>& segs, Transport& tr,
+	const allreduce_options& opts, Prepare prepare, Finish finish)
+{
+	const int p = tr.size(), r = tr.rank();
+	std::size_t bytes = 0;
+	for (const allreduce_segment& s : segs) bytes = std::max(bytes, s.count * s.size);
+	std::vector<unsigned char> scratch(bytes);
+	std::size_t total = 0;
+	for (const allreduce_segment& s : segs) total += s.count * s.size;
+
+	std::vector<char> prepared(segs.size(), 0);
+	auto need = [&](std::size_t s) {
+		if (!prepared[s]) { prepared[s] = 1; prepare(s); }
+	};
+
+	if (p == 1) {
+		for (std::size_t s = 0; s < segs.size(); ++s) { need(s); finish(s); }
+		return;
+	}
+
+	if (total < opts.ring_threshold) {
+		// reduce towards rank 0, children are r + mask for every mask below
+		// the lowest set bit of r
+		int mask = 1;
+		for (; mask < p; mask <<= 1) {
+			if (r & mask) break;
+			if (r + mask >= p) continue;
+			for (std::size_t s = 0; s < segs.size(); ++s) {
+				need(s);
+				allreduce_segment& g = segs[s];
+				tr.recv(r + mask, int(s), scratch.data(), g.count * g.size);
+				g.add(g.data, scratch.data(), g.count);
+			}
+		}
+		if (r != 0) {
+			for (std::size_t s = 0; s < segs.size(); ++s) {
+				need(s);
+				tr.send(r - mask, int(s), segs[s].data, segs[s].count * segs[s].size);
+			}
+			for (std::size_t s = 0; s < segs.size(); ++s)
+				tr.recv(r - mask, int(s), segs[s].data, segs[s].count * segs[s].size);
+		}
+		// broadcast back down the same tree
+		for (int m = mask >> 1; m > 0; m >>= 1)
+			if (r + m < p)
+				for (std::size_t s = 0; s < segs.size(); ++s)
+					tr.send(r + m, int(s), segs[s].data, segs[s].count * segs[s].size);
+		for (std::size_t s = 0; s < segs.size(); ++s) { need(s); finish(s); }
+		return;
+	}
+
+	// ring, segment s is split into p chunks of elements
+	auto lo = [p](const allreduce_segment& g, int j) { return g.count * std::size_t(j) / std::size_t(p); };
+	auto chunk = [&](const allreduce_segment& g, int j) {
+		return std::make_pair(g.data + lo(g, j) * g.size, (lo(g, j + 1) - lo(g, j)) * g.size);
+	};
+	const int next = (r + 1) % p, prev = (r + p - 1) % p;
+	auto mod = [p](int j) { return ((j % p) + p) % p; };
+
+	for (int k = 0; k < p - 1; ++k) {
+		for (std::size_t s = 0; s < segs.size(); ++s) {
+			need(s);
+			auto c = chunk(segs[s], mod(r - k));
+			tr.send(next, int(s), c.first, c.second);
+		}
+		for (std::size_t s = 0; s < segs.size(); ++s) {
+			allreduce_segment& g = segs[s];
+			auto c = chunk(g, mod(r - k - 1));
+			tr.recv(prev, int(s), scratch.data(), c.second);
+			g.add(c.first, scratch.data(), c.second / g.size);
+		}
 	}
+	for (int k = 0; k < p - 1; ++k) {
+		for (std::size_t s = 0; s < segs.size(); ++s) {
+			auto c = chunk(segs[s], mod(r + 1 - k));
+			tr.send(next, int(s), c.first, c.second);
+		}
+		for (std::size_t s = 0; s < segs.size(); ++s) {
+			auto c = chunk(segs[s], mod(r - k));
+			tr.recv(prev, int(s), c.first, c.second);
+			if (k == p - 2) finish(s);
+		}
+	}
+}
 
-	T val;
+// leaves are grouped into one typed buffer per value type and add policy
+template< typename Leaf >
+struct allreduce_key
+{
+	using type = type_list< typename Leaf::value_type, typename leaf_add_policy<Leaf>::type >;
+};
+
+template< typename Tree >
+struct allreduce_layout;
+
+template< typename Tree >
+struct allreduce_layout_of;
+
+template< typename... Leaves >
+struct allreduce_layout_of< type_list<Leaves...> >
+{
+	using keys = typename type_list_unique< type_list<>, typename allreduce_key<Leaves>::type... >::type;
+
+	static constexpr std::size_t segments = type_list_size<keys>::value;
+
+	// the segment of every leaf, in scan order
+	static constexpr std::array< std::size_t, sizeof...(Leaves) > segment{ {
+		type_list_index< typename allreduce_key<Leaves>::type >(keys{})... } };
+
+	// the position of every leaf within its segment
+	static constexpr std::array< std::size_t, sizeof...(Leaves) > make_position() {
+		std::array< std::size_t, sizeof...(Leaves) > pos{};
+		std::array< std::size_t, segments > seen{};
+		for (std::size_t i = 0; i < sizeof...(Leaves); ++i) pos[i] = seen[segment[i]]++;
+		return pos;
+	}
+
+	static constexpr std::array< std::size_t, sizeof...(Leaves) > position = make_position();
+
+	static constexpr std::array< std::size_t, segments > make_count() {
+		std::array< std::size_t, segments > n{};
+		for (std::size_t s : segment) ++n[s];
+		return n;
+	}
+
+	static constexpr std::array< std::size_t, segments > count = make_count();
+};
+
+template< typename Tree >
+struct allreduce_layout : allreduce_layout_of< typename tree_leaves<Tree>::type > {};
+
+// the first leaf of Tree in segment S
+template< std::size_t S, typename Tree, std::size_t I = 0,
+	bool Found = (allreduce_layout<Tree>::segment[I] == S) >
+struct allreduce_first_leaf : allreduce_first_leaf< S, Tree, I + 1 > {};
+
+template< std::size_t S, typename Tree, std::size_t I >
+struct allreduce_first_leaf< S, Tree, I, true >
+{
+	using type = typename type_list_at< I, typename tree_leaves<Tree>::type >::type;
+};
+
+template< typename Tree, std::size_t... Ss >
+std::vector<allreduce_segment> allreduce_tree_segments(
+	std::vector< std::vector<unsigned char> >& buffers, std::index_sequence<Ss...>)
+{
+	using layout = allreduce_layout<Tree>;
+	std::vector<allreduce_segment> segs;
+	(segs.push_back({ nullptr, layout::count[Ss],
+		sizeof(typename allreduce_first_leaf<Ss, Tree>::type::value_type),
+		&allreduce_add< typename allreduce_first_leaf<Ss, Tree>::type > }), ...);
+	buffers.resize(segs.size());
+	for (std::size_t s = 0; s < segs.size(); ++s) {
+		buffers[s].resize(segs[s].count * segs[s].size);
+		segs[s].data = buffers[s].data();
+	}
+	return segs;
+}
+
+// copy the leaves of segment s between t and its buffer
+template< typename Tree, std::size_t... Is >
+void allreduce_pack(const Tree& t, std::size_t s, unsigned char* buf, std::index_sequence<Is...>)
+{
+	using layout = allreduce_layout<Tree>;
+	((layout::segment[Is] == s ? (void)std::memcpy(buf + layout::position[Is] * sizeof(leaf_at<Is>(t).val),
+		&leaf_at<Is>(t).val, sizeof(leaf_at<Is>(t).val)) : (void)0), ...);
+}
+
+template< typename Tree, std::size_t... Is >
+void allreduce_unpack(Tree& t, std::size_t s, const unsigned char* buf, std::index_sequence<Is...>)
+{
+	using layout = allreduce_layout<Tree>;
+	((layout::segment[Is] == s ? (void)std::memcpy(&leaf_at<Is>(t).val,
+		buf + layout::position[Is] * sizeof(leaf_at<Is>(t).val), sizeof(leaf_at<Is>(t).val)) : (void)0), ...);
+}
+
+// Replace t on every rank of tr by the sum of t over all ranks.
+// The leaves are packed into one contiguous buffer per value type,
+// following the compile time layout of Tree, and reduced buffer by buffer.
+template< typename Tree, typename Transport >
+void allreduce(Tree& t, Transport& tr, const allreduce_options& opts = {})
+{
+	using leaves = std::make_index_sequence< leaf_count<Tree>::value >;
+	std::vector< std::vector<unsigned char> > buffers;
+	std::vector<allreduce_segment> segs = allreduce_tree_segments<Tree>(buffers,
+		std::make_index_sequence< allreduce_layout<Tree>::segments >{});
+	allreduce_segments(segs, tr, opts,
+		[&](std::size_t s) { allreduce_pack(t, s, segs[s].data, leaves{}); },
+		[&](std::size_t s) { allreduce_unpack(t, s, segs[s].data, leaves{}); });
+}
+
+// collect every column of a TreeSoA as an allreduce segment
+struct allreduce_columns_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, std::vector<allreduce_segment>& out) {
+		apply_impl(is_leaf<typename Child::node_type>{}, get<Child>(a), out);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, Child& c, std::vector<allreduce_segment>& out) {
+		using T = typename Child::node_type::value_type;
+		out.push_back({ reinterpret_cast<unsigned char*>(c.col.data()), c.col.size(), sizeof(T),
+			&allreduce_add< typename Child::node_type > });
+	}
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, Child& c, std::vector<allreduce_segment>& out) {
+		inher_tree_scan< allreduce_columns_f >(c, out);
+	}
+};
+
+// elementwise max of two arrays of std::uint64_t
+inline void allreduce_max_u64(void* dst, const void* src, std::size_t n)
+{
+	std::uint64_t* d = static_cast<std::uint64_t*>(dst);
+	const std::uint64_t* s = static_cast<const std::uint64_t*>(src);
+	for (std::size_t i = 0; i < n; ++i) d[i] = std::max(d[i], s[i]);
+}
+
+// Row wise sum of equally sized batches over all ranks of tr, the
+// columns are reduced in place without packing. The batch sizes are
+// reduced first (the max of n and of ~n, so every rank learns both the
+// largest and the smallest), and all ranks throw std::invalid_argument
+// when they differ, before any column is exchanged.
+template< typename Tree, typename Transport >
+void allreduce(TreeSoA<Tree>& batch, Transport& tr, const allreduce_options& opts = {})
+{
+	const std::uint64_t n = batch.size();
+	std::uint64_t sizes[2] = { n, ~n };
+	std::vector<allreduce_segment> check{ { reinterpret_cast<unsigned char*>(sizes), 2,
+		sizeof(std::uint64_t), &allreduce_max_u64 } };
+	allreduce_segments(check, tr, opts, [](std::size_t) {}, [](std::size_t) {});
+	if (sizes[0] != ~sizes[1])
+		throw std::invalid_argument("allreduce: batch sizes differ across ranks, from " +
+			std::to_string(~sizes[1]) + " to " + std::to_string(sizes[0]) + " rows");
+
+	std::vector<allreduce_segment> segs;
+	inher_tree_scan< allreduce_columns_f >(batch, segs);
+	allreduce_segments(segs, tr, opts, [](std::size_t) {}, [](std::size_t) {});
+}
+
+// ******************************************************************
+// MEMORY MAPPED COLUMNAR FILES FOR TREE BATCHES
+// ******************************************************************
+
+// append the dotted mpl::c_str<name> path of every leaf of Node to out,
+// in scan order, e.g. "one.two.three.E"
+template< typename Node >
+void collect_leaf_paths(const std::string& prefix, std::vector<std::string>& out);
+
+template< typename Node >
+void collect_leaf_paths_impl(mpl::true_, const std::string& path, std::vector<std::string>& out)
+{
+	out.push_back(path);
+}
+
+template< typename... Children >
+void collect_child_leaf_paths(type_list<Children...>, const std::string& path,
+	std::vector<std::string>& out)
+{
+	(collect_leaf_paths<Children>(path, out), ...);
+}
+
+template< typename Node >
+void collect_leaf_paths_impl(mpl::false_, const std::string& path, std::vector<std::string>& out)
+{
+	collect_child_leaf_paths(typename Node::child_types{}, path, out);
+}
+
+template< typename Node >
+void collect_leaf_paths(const std::string& prefix, std::vector<std::string>& out)
+{
+	std::string path = prefix;
+	if (path != "") path += ".";
+	path += mpl::c_str<typename Node::name>::value;
+	collect_leaf_paths_impl<Node>(is_leaf<Node>{}, path, out);
+}
+
+template< typename Tree >
+std::vector<std::string> leaf_paths()
+{
+	std::vector<std::string> paths;
+	collect_leaf_paths<Tree>("", paths);
+	return paths;
+}
+
+// On disk layout (native endianness, recorded by soa_file_header::byte_order)
+// * soa_file_header
+// * one soa_file_column per leaf, in scan order
+// * the leaf paths, referenced by soa_file_column::path_offset
+// * the columns, each starting on a soa_file_align boundary
+constexpr std::size_t soa_file_align = 64;
+constexpr char soa_file_magic[8] = { 'R','A','P','I','D','S','O','A' };
+constexpr std::uint32_t soa_file_version = 2;
+constexpr std::uint32_t soa_file_byte_order = 0x01020304;
+
+struct soa_file_header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byte_order;
+	std::uint32_t leaf_count;
+	std::uint32_t reserved;
+	std::uint64_t rows;
+};
+
+struct soa_file_column
+{
+	std::uint64_t offset;
+	std::uint32_t value_size;
+	std::uint32_t type_tag;
+	std::uint32_t path_offset;
+	std::uint32_t path_size;
+};
+
+// The type of the values of a column, independent of the build:
+// * bits 0-7 the size of the scalar
+// * bits 8-11 its class, 1 signed, 2 unsigned, 3 floating point, 4 bool
+// * bit 12 set for a std::array of such scalars
+// Any other trivially copyable value has tag 0 and is checked by size only.
+template< typename T >
+struct soa_file_type_tag
+{
+	static constexpr std::uint32_t value =
+		std::is_same<T, bool>::value ? 0x400u | sizeof(T) :
+		std::is_floating_point<T>::value ? 0x300u | sizeof(T) :
+		std::is_integral<T>::value ? (std::is_signed<T>::value ? 0x100u : 0x200u) | sizeof(T) :
+		0u;
+};
+
+template< typename E, std::size_t N >
+struct soa_file_type_tag< std::array<E, N> >
+{
+	static constexpr std::uint32_t value =
+		soa_file_type_tag<E>::value != 0 ? 0x1000u | soa_file_type_tag<E>::value : 0u;
+};
+
+template< typename Leaves >
+struct soa_file_type_tags;
+
+template< typename... Leaves >
+struct soa_file_type_tags< type_list<Leaves...> >
+{
+	static constexpr std::uint32_t value[sizeof...(Leaves) + 1] = {
+		soa_file_type_tag<typename Leaves::value_type>::value..., 0u };
+};
+
+// collect the address of every column of a soa_node, in scan order
+struct soa_column_data_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, std::vector<const void*>& out) {
+		apply_impl(is_leaf<typename Child::node_type>{}, get<Child>(a), out);
+	}
+
+private:
+	template<typename Child>
+	static void apply_impl(mpl::true_, const Child& c, std::vector<const void*>& out) {
+		out.push_back(c.col.data());
+	}
+
+	template<typename Child>
+	static void apply_impl(mpl::false_, const Child& c, std::vector<const void*>& out) {
+		inher_tree_scan< soa_column_data_f >(c, out);
+	}
+};
+
+// read only mirror of a soa_node whose columns point into external memory
+template<typename Node>
+struct soa_view_node;
+
+// point the columns of a soa_view_node at a list of addresses, in scan order
+struct soa_view_bind_f
+{
+	template<typename Parent, typename Child>
+	static void apply(Parent& a, const void* const*& it) {
+		get<Child>(a).bind(it);
+	}
+};
+
+template<typename Name, typename... ChildNodes>
+struct soa_view_node< InternalNode<Name, ChildNodes...> >
+	: soa_view_node<ChildNodes>...
+{
+	using name = Name;
+	using node_type = InternalNode<Name, ChildNodes...>;
+	using base_type = mpl::vector< soa_view_node<ChildNodes>... >;
+	using child_types = type_list< soa_view_node<ChildNodes>... >;
+
+	void bind(const void* const*& it) { inher_tree_scan< soa_view_bind_f >(*this, it); }
+
+	void load(node_type& t, std::size_t i) const {
+		inher_tree_scan< soa_load_f >(*this, t, i);
+	}
+};
+
+template<typename Name, typename T>
+struct soa_view_node< LeafNode<Name, T> >
+{
+	using name = Name;
+	using node_type = LeafNode<Name, T>;
+
+	void bind(const void* const*& it) { col = static_cast<const T*>(*it++); }
+
+	void load(node_type& l, std::size_t i) const { l.val = col[i]; }
+
+	const T* col = nullptr;
+};
+
+// A read only TreeSoA whose columns live in external memory, such as a
+// memory mapped soa file. No data is copied or parsed.
+template<typename Tree>
+class TreeSoAView
+	: public soa_view_node<Tree>
+{
+public:
+	TreeSoAView(const void* const* columns, std::size_t n) : n_(n) {
+		this->bind(columns);
+	}
+
+	std::size_t size() const { return n_; }
+
+	Tree operator[](std::size_t i) const {
+		Tree t;
+		this->load(t, i);
+		return t;
+	}
+
+	// the contiguous column of a single leaf
+	template<typename Leaf>
+	const typename Leaf::value_type* column() const {
+		return get< soa_view_node<Leaf> >(*this).col;
+	}
+
+private:
+	std::size_t n_;
+};
+
+inline std::size_t soa_file_round_up(std::size_t n)
+{
+	return (n + soa_file_align - 1) / soa_file_align * soa_file_align;
+}
+
+// write a TreeSoA into a columnar soa file
+template<typename Tree>
+void write_soa_file(const TreeSoA<Tree>& soa, const std::string& filename)
+{
+	using layout = tree_layout<Tree>;
+	const std::vector<std::string> paths = leaf_paths<Tree>();
+
+	std::vector<const void*> data;
+	inher_tree_scan< soa_column_data_f >(soa, data);
+
+	soa_file_header header{};
+	std::memcpy(header.magic, soa_file_magic, sizeof(header.magic));
+	header.version = soa_file_version;
+	header.byte_order = soa_file_byte_order;
+	header.leaf_count = static_cast<std::uint32_t>(layout::leaf_count);
+	header.rows = soa.size();
+
+	// the header, column table and paths, followed by the aligned columns
+	std::vector<soa_file_column> columns(layout::leaf_count);
+	std::size_t offset = sizeof(header) + sizeof(soa_file_column) * columns.size();
+	for (std::size_t i = 0; i < columns.size(); ++i) {
+		columns[i].path_offset = static_cast<std::uint32_t>(offset);
+		columns[i].path_size = static_cast<std::uint32_t>(paths[i].size());
+		offset += paths[i].size();
+	}
+	for (std::size_t i = 0; i < columns.size(); ++i) {
+		offset = soa_file_round_up(offset);
+		columns[i].offset = offset;
+		columns[i].value_size = static_cast<std::uint32_t>(layout::leaf[i].size);
+		columns[i].type_tag = soa_file_type_tags< typename tree_leaves<Tree>::type >::value[i];
+		offset += layout::leaf[i].size * soa.size();
+	}
+
+	std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+	auto write_at = [&out](std::size_t pos, const void* p, std::size_t n) {
+		static const char zeros[soa_file_align] = {};
+		while (static_cast<std::size_t>(out.tellp()) < pos)
+			out.write(zeros, std::min(soa_file_align, pos - static_cast<std::size_t>(out.tellp())));
+		out.write(static_cast<const char*>(p), n);
+	};
+	write_at(0, &header, sizeof(header));
+	write_at(sizeof(header), columns.data(), sizeof(soa_file_column) * columns.size());
+	for (std::size_t i = 0; i < columns.size(); ++i)
+		write_at(columns[i].path_offset, paths[i].data(), paths[i].size());
+	for (std::size_t i = 0; i < columns.size(); ++i)
+		write_at(columns[i].offset, data[i], columns[i].value_size * soa.size());
+
+	if (!out) throw std::runtime_error("write_soa_file: failed to write " + filename);
+}
+
+// view the bytes of a soa file (typically mmap-ed) as a TreeSoAView
+// Only the header is checked against the schema of Tree; the columns
+// are used in place. The buffer must be aligned to soa_file_align.
+template<typename Tree>
+TreeSoAView<Tree> soa_file_view(const unsigned char* file, std::size_t bytes)
+{
+	using layout = tree_layout<Tree>;
+	auto fail = [](const char* what) {
+		throw std::runtime_error(std::string("soa_file_view: ") + what);
+	};
+
+	soa_file_header header;
+	if (bytes < sizeof(header)) fail("truncated header");
+	std::memcpy(&header, file, sizeof(header));
+	if (std::memcmp(header.magic, soa_file_magic, sizeof(header.magic)) != 0) fail("not a soa file");
+	if (header.byte_order != soa_file_byte_order) fail("byte order mismatch");
+	if (header.version != soa_file_version) fail("unsupported version");
+	if (header.leaf_count != layout::leaf_count) fail("schema mismatch");
+	if (bytes < sizeof(header) + sizeof(soa_file_column) * header.leaf_count)
+		fail("truncated column table");
+
+	const std::vector<std::string> paths = leaf_paths<Tree>();
+	std::vector<const void*> data(layout::leaf_count);
+	for (std::size_t i = 0; i < layout::leaf_count; ++i) {
+		soa_file_column c;
+		std::memcpy(&c, file + sizeof(header) + sizeof(c) * i, sizeof(c));
+		if (c.value_size != layout::leaf[i].size ||
+			c.type_tag != soa_file_type_tags< typename tree_leaves<Tree>::type >::value[i] ||
+			c.path_offset > bytes || c.path_size > bytes - c.path_offset ||
+			paths[i].compare(0, std::string::npos,
+				reinterpret_cast<const char*>(file) + c.path_offset, c.path_size) != 0)
+			fail("schema mismatch");
+		// bounds checked by division, offset + value_size * rows may overflow
+		if (c.offset % soa_file_align != 0 || c.offset > bytes ||
+			(c.value_size != 0 && header.rows > (bytes - c.offset) / c.value_size))
+			fail("corrupt column");
+		data[i] = file + c.offset;
+	}
+
+	return TreeSoAView<Tree>(data.data(), header.rows);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// A memory mapped soa file, readable as a TreeSoAView for its lifetime
+template<typename Tree>
+class mapped_soa_file
+{
+public:
+	explicit mapped_soa_file(const std::string& filename) {
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("mapped_soa_file: cannot open " + filename);
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+			::close(fd);
+			throw std::runtime_error("mapped_soa_file: cannot stat " + filename);
+		}
+		bytes_ = static_cast<std::size_t>(st.st_size);
+		void* p = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) throw std::runtime_error("mapped_soa_file: cannot map " + filename);
+		data_ = static_cast<const unsigned char*>(p);
+	}
+
+	mapped_soa_file(const mapped_soa_file&) = delete;
+	mapped_soa_file& operator=(const mapped_soa_file&) = delete;
+
+	~mapped_soa_file() { ::munmap(const_cast<unsigned char*>(data_), bytes_); }
+
+	TreeSoAView<Tree> view() const { return soa_file_view<Tree>(data_, bytes_); }
+
+private:
+	const unsigned char* data_;
+	std::size_t bytes_;
+};
+
+#endif
+
+// ******************************************************************
+// SCHEMA EVOLUTION AND CROSS SCHEMA CONVERSION
+// ******************************************************************
+
+// true when two lists of names are spelled the same
+template< typename A, typename B, bool = (type_list_size<A>::value == type_list_size<B>::value) >
+struct same_names : std::false_type {};
+
+template< typename... As, typename... Bs >
+struct same_names< type_list<As...>, type_list<Bs...>, true >
+	: std::integral_constant< bool, (chars_equal(static_name<As>::value,
+		static_name<Bs>::value.data(), static_name<Bs>::size) && ...) > {};
+
+// the names of a leaf_path below its root, the root itself may be renamed
+template< typename Path >
+struct path_below_root;
+
+template< typename Root, typename... Names, typename Leaf >
+struct path_below_root< leaf_path< type_list<Root, Names...>, Leaf > >
+{
+	using type = type_list<Names...>;
+};
+
+constexpr std::size_t convert_npos = std::size_t(-1);
+
+// scan order index of the leaf of Old found at the same path as the
+// leaf_path NewPath, or convert_npos
+template< typename NewPath, typename... OldPaths >
+constexpr std::size_t convert_source(type_list<OldPaths...>)
+{
+	using names = typename path_below_root<NewPath>::type;
+	std::size_t i = 0, found = convert_npos;
+	((found = (found == convert_npos &&
+		same_names< names, typename path_below_root<OldPaths>::type >::value) ? i : found, ++i), ...);
+	return found;
+}
+
+// Compile time mapping of the leaves of New onto the leaves of Old
+// source[I] is the index of the Old leaf feeding the I-th New leaf
+template< typename New, typename Old >
+struct convert_map
+{
+	using new_paths = typename tree_leaf_paths<New>::type;
+	using old_paths = typename tree_leaf_paths<Old>::type;
+
+	template< typename... NewPaths >
+	static constexpr std::array< std::size_t, sizeof...(NewPaths) > make(type_list<NewPaths...>) {
+		return { { convert_source<NewPaths>(old_paths{})... } };
+	}
+
+	static constexpr std::array< std::size_t, leaf_count<New>::value > source = make(new_paths{});
+};
+
+// a value of type U converted to the leaf value type T
+template< typename T, typename U >
+T convert_value(const U& u)
+{
+	static_assert(std::is_constructible<T, const U&>::value || std::is_convertible<const U&, T>::value,
+		"convert: the leaf value types at a matching path are not convertible");
+	return static_cast<T>(u);
+}
+
+template< std::size_t S, typename NewLeaf, typename Old >
+void convert_leaf(NewLeaf& l, const Old& o)
+{
+	if constexpr (S == convert_npos)
+		l = NewLeaf();
+	else
+		l.val = convert_value< typename NewLeaf::value_type >(leaf_at<S>(o).val);
+}
+
+template< typename New, typename Old, std::size_t... Is >
+void convert_impl(New& n, const Old& o, std::index_sequence<Is...>)
+{
+	(convert_leaf< convert_map<New, Old>::source[Is] >(leaf_at<Is>(n), o), ...);
+}
+
+// Convert a tree into the schema New, leaves are matched by their path
+// of names below the root:
+// * matching leaves are copied, converted when their value types differ
+// * leaves of New without a match are value initialized
+// * leaves of Old without a match are dropped
+// The mapping is resolved at compile time into one assignment per leaf.
+template< typename New, typename Old >
+New convert(const Old& o)
+{
+	New n;
+	convert_impl(n, o, std::make_index_sequence< leaf_count<New>::value >{});
+	return n;
+}
+
+// convert n trees of src into dst
+template< typename New, typename Old >
+void convert_batch(const Old* src, std::size_t n, New* dst)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		convert_impl(dst[i], src[i], std::make_index_sequence< leaf_count<New>::value >{});
+}
+
+// column of the I-th leaf of a TreeSoA or TreeSoAView, as a pointer
+template< typename Leaf, typename Tree >
+const typename Leaf::value_type* convert_column(const TreeSoA<Tree>& s) { return s.template column<Leaf>().data(); }
+
+template< typename Leaf, typename Tree >
+const typename Leaf::value_type* convert_column(const TreeSoAView<Tree>& s) { return s.template column<Leaf>(); }
+
+template< std::size_t I, std::size_t S, typename New, typename Old, typename Src >
+void convert_soa_column(TreeSoA<New>& dst, const Src& src)
+{
+	if constexpr (S != convert_npos) {
+		using new_leaf = typename type_list_at< I, typename tree_leaves<New>::type >::type;
+		using old_leaf = typename type_list_at< S, typename tree_leaves<Old>::type >::type;
+		using T = typename new_leaf::value_type;
+		using U = typename old_leaf::value_type;
+		T* out = dst.template column<new_leaf>().data();
+		const U* in = convert_column<old_leaf>(src);
+		if constexpr (std::is_same<T, U>::value && std::is_trivially_copyable<T>::value)
+			std::memcpy(out, in, sizeof(T) * dst.size());
+		else
+			for (std::size_t i = 0; i < dst.size(); ++i) out[i] = convert_value<T>(in[i]);
+	}
+}
+
+template< typename New, typename Old, typename Src, std::size_t... Is >
+TreeSoA<New> convert_soa_impl(const Src& src, std::size_t n, std::index_sequence<Is...>)
+{
+	TreeSoA<New> dst(n);
+	(convert_soa_column< Is, convert_map<New, Old>::source[Is], New, Old >(dst, src), ...);
+	return dst;
+}
+
+// column wise conversion of a batch, columns of equal type are a single memcpy
+// and unmatched columns stay value initialized
+template< typename New, typename Old >
+TreeSoA<New> convert(const TreeSoA<Old>& src)
+{
+	return convert_soa_impl<New, Old>(src, src.size(), std::make_index_sequence< leaf_count<New>::value >{});
+}
+
+template< typename New, typename Old >
+TreeSoA<New> convert(const TreeSoAView<Old>& src)
+{
+	return convert_soa_impl<New, Old>(src, src.size(), std::make_index_sequence< leaf_count<New>::value >{});
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// read a soa file written with the schema Old into a batch of schema New
+template< typename New, typename Old >
+TreeSoA<New> convert_soa_file(const std::string& filename)
+{
+	mapped_soa_file<Old> file(filename);
+	return convert<New>(file.view());
+}
+
+#endif
+
+// ******************************************************************
+// STREAMING PIPELINES OVER RECORD STREAMS
+// ******************************************************************
+
+// Blocking FIFO of at most capacity elements shared between two stages
+// * push blocks while full, pop blocks while empty
+// * after close, push fails and pop drains what is left, then fails
+template< typename T >
+class bounded_queue
+{
+public:
+	explicit bounded_queue(std::size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+	bool push(T v) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_full_.wait(lock, [&] { return closed_ || queue_.size() < capacity_; });
+		if (closed_) return false;
+		queue_.push_back(std::move(v));
+		not_empty_.notify_one();
+		return true;
+	}
+
+	bool pop(T& v) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_empty_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+		if (queue_.empty()) return false;
+		v = std::move(queue_.front());
+		queue_.pop_front();
+		not_full_.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+		not_full_.notify_all();
+		not_empty_.notify_all();
+	}
+
+private:
+	std::size_t capacity_;
+	std::deque<T> queue_;
+	std::mutex mutex_;
+	std::condition_variable not_full_;
+	std::condition_variable not_empty_;
+	bool closed_ = false;
+};
+
+// closes the queues of a stage however the stage ends
+template< typename... Queues >
+struct queue_close_guard
+{
+	std::tuple<Queues&...> queues;
+	~queue_close_guard() { std::apply([](auto&... q) { (q.close(), ...); }, queues); }
+};
+
+template< typename... Queues >
+queue_close_guard<Queues...> close_on_exit(Queues&... q) { return { { q... } }; }
+
+struct pipeline_options
+{
+	std::size_t batch = 256;       // trees decoded, transformed and encoded together
+	std::size_t queue_depth = 4;   // batches buffered between two stages
+};
+
+// A transform stage applying inher_tree_scan<Funcs> to each tree in turn,
+// all with the same params, e.g. scan_stage<add_eq>(offset)
+template< typename... Funcs, typename... Params >
+auto scan_stage(Params... params)
+{
+	return [=](auto& t) { (inher_tree_scan<Funcs>(t, params...), ...); };
+}
+
+// Decode, transform and encode a stream of trees in three concurrent stages
+// * source(bytes, max) writes up to max records in the flat packed layout
+//   of tree_layout<Tree> to bytes and returns the count, 0 ends the stream
+// * transform(tree) is called on every decoded tree
+// * sink(bytes, n) receives n encoded records
+// Decoding and transforming run on their own threads, encoding on the
+// calling one, so I/O overlaps with compute. An exception thrown by any
+// stage stops the pipeline and is rethrown. Returns the number of trees.
+template< typename Tree, typename Source, typename Transform, typename Sink >
+std::size_t tree_pipeline(Source&& source, Transform&& transform, Sink&& sink,
+	pipeline_options opts = {})
+{
+	constexpr std::size_t record = tree_layout<Tree>::size;
+	using batch = std::vector<Tree>;
+	const std::size_t batch_size = opts.batch ? opts.batch : 1;
+
+	bounded_queue<batch> decoded(opts.queue_depth);
+	bounded_queue<batch> transformed(opts.queue_depth);
+
+	auto decode = std::async(std::launch::async, [&] {
+		auto guard = close_on_exit(decoded);
+		std::vector<unsigned char> bytes(batch_size * record);
+		for (std::size_t n; (n = source(bytes.data(), batch_size)) != 0; ) {
+			batch b(n);
+			for (std::size_t i = 0; i < n; ++i)
+				deserialize(b[i], bytes.data() + i * record);
+			if (!decoded.push(std::move(b))) break;
+		}
+	});
+
+	auto compute = std::async(std::launch::async, [&] {
+		auto guard = close_on_exit(decoded, transformed);
+		for (batch b; decoded.pop(b); ) {
+			for (Tree& t : b) transform(t);
+			if (!transformed.push(std::move(b))) break;
+		}
+	});
+
+	std::size_t count = 0;
+	{
+		auto guard = close_on_exit(decoded, transformed);
+		std::vector<unsigned char> bytes;
+		for (batch b; transformed.pop(b); ) {
+			bytes.resize(b.size() * record);
+			for (std::size_t i = 0; i < b.size(); ++i)
+				serialize(b[i], bytes.data() + i * record);
+			sink(static_cast<const unsigned char*>(bytes.data()), b.size());
+			count += b.size();
+		}
+	}
+
+	decode.get();
+	compute.get();
+	return count;
+}
+
+// source reading packed records of Tree from a stream. A stream ending
+// inside a record throws, once the complete records before it are read.
+template< typename Tree >
+struct istream_source
+{
+	std::istream& is;
+	std::size_t partial = 0; // bytes of a trailing incomplete record
+
+	std::size_t operator()(unsigned char* bytes, std::size_t max) {
+		constexpr std::size_t record = tree_layout<Tree>::size;
+		if (partial == 0) {
+			is.read(reinterpret_cast<char*>(bytes), static_cast<std::streamsize>(max * record));
+			const std::size_t got = static_cast<std::size_t>(is.gcount());
+			partial = got % record;
+			if (got >= record) return got / record;
+		}
+		if (partial != 0)
+			throw std::runtime_error("istream_source: truncated record, " +
+				std::to_string(partial) + " of " + std::to_string(record) + " bytes");
+		return 0;
+	}
+};
+
+// sink writing packed records of Tree to a stream
+template< typename Tree >
+struct ostream_sink
+{
+	std::ostream& os;
+
+	void operator()(const unsigned char* bytes, std::size_t n) {
+		os.write(reinterpret_cast<const char*>(bytes),
+			static_cast<std::streamsize>(n * tree_layout<Tree>::size));
+	}
 };
 
 // ******************************************************************
 // MAIN
 // ******************************************************************
 
+#if !defined(RAPID_NO_MAIN)
 int main()
 {
 
@@ -296,4 +6160,5 @@ int main()
 	std::cout << std::endl;
 
 	return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
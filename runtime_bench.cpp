@@ -0,0 +1,404 @@
+/*
+Runtime benchmarks for inheritance trees.
+Copyright (C) 2023  Dustin Sanford
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+Times +=, rand_gen and print of inheritance trees against a hand written
+plain struct with the same members, plus the batch, SoA and parallel
+paths, on Bar and on generated trees of various widths and depths. Built
+with Google Benchmark, see runtime_bench.sh.
+
+The rapid_asm_* functions are never inlined and have C linkage, so the
+code generated for a tree operation and for its plain struct baseline
+can be compared directly, e.g. ./runtime_bench.sh asm
+*/
+
+#define RAPID_NO_MAIN
+#include "rapid_snippit.cpp"
+
+#include "bench_tree.hpp"
+
+#include <benchmark/benchmark.h>
+
+// the tree used by main()
+using Bar = InternalNode<
+	mpl::string< 'o','n','e' >,
+	LeafNode<mpl::string< 'A'>, int>,
+	LeafNode<mpl::string<'B'>, float >,
+	InternalNode<
+		mpl::string<'t','w','o'>,
+		LeafNode<mpl::string<'D'>, double > ,
+		InternalNode<
+			mpl::string<'t','h','r','e','e'>,
+			LeafNode<mpl::string<'E'>, long >
+		>
+	>,
+	LeafNode<mpl::string< 'F'>, double>,
+	LeafNode<mpl::string<'G'>,  int>
+>;
+
+// the hand written equivalent of Bar
+struct BarPlain
+{
+	int A;
+	float B;
+	double D;
+	long E;
+	double F;
+	int G;
+
+	BarPlain& operator+=(const BarPlain& rhs) {
+		A += rhs.A;
+		B += rhs.B;
+		D += rhs.D;
+		E += rhs.E;
+		F += rhs.F;
+		G += rhs.G;
+		return *this;
+	}
+
+	template <typename Generator>
+	void rand_gen(Generator& gen) {
+		std::normal_distribution<> dist{ 100, 50 };
+		A = static_cast<int>(dist(gen));
+		B = static_cast<float>(dist(gen));
+		D = static_cast<double>(dist(gen));
+		E = static_cast<long>(dist(gen));
+		F = static_cast<double>(dist(gen));
+		G = static_cast<int>(dist(gen));
+	}
+
+	void print(std::string prefix) {
+		prefix += " one ";
+		std::cout << prefix << "A == " << A << std::endl;
+		std::cout << prefix << "B == " << B << std::endl;
+		std::cout << prefix << "two D == " << D << std::endl;
+		std::cout << prefix << "two three E == " << E << std::endl;
+		std::cout << prefix << "F == " << F << std::endl;
+		std::cout << prefix << "G == " << G << std::endl;
+	}
+};
+
+using Wide = bench_tree_wd< 20, 1 >;
+using Deep = bench_tree_wd< 2, 6 >;
+using Square = bench_tree_wd< 10, 2, std::tuple<double> >;
+
+// ******************************************************************
+// ASM INSPECTION HOOKS
+// ******************************************************************
+
+extern "C" {
+
+__attribute__((noinline)) void rapid_asm_add_eq_tree(Bar& a, const Bar& b) { a += b; }
+__attribute__((noinline)) void rapid_asm_add_eq_plain(BarPlain& a, const BarPlain& b) { a += b; }
+
+__attribute__((noinline)) void rapid_asm_rand_gen_tree(Bar& a, std::mt19937& gen) { a.rand_gen(gen); }
+__attribute__((noinline)) void rapid_asm_rand_gen_plain(BarPlain& a, std::mt19937& gen) { a.rand_gen(gen); }
+
+__attribute__((noinline)) void rapid_asm_add_eq_aos(Bar* a, const Bar* b, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i) a[i] += b[i];
+}
+__attribute__((noinline)) void rapid_asm_add_eq_aos_plain(BarPlain* a, const BarPlain* b, std::size_t n) {
+	for (std::size_t i = 0; i < n; ++i) a[i] += b[i];
+}
+
+__attribute__((noinline)) double rapid_asm_tree_sum(const Bar& a) { return tree_sum(a); }
+
+}
+
+// ******************************************************************
+// SINGLE TREE OPERATIONS
+// ******************************************************************
+
+// swallows everything written to std::cout while a print benchmark runs
+class null_cout
+{
+	struct null_buf : std::streambuf {
+		int overflow(int c) override { return c; }
+		std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+	};
+
+	null_buf buf_;
+	std::streambuf* old_;
+
+public:
+	null_cout() : old_(std::cout.rdbuf(&buf_)) {}
+	~null_cout() { std::cout.rdbuf(old_); }
+};
+
+template< typename Tree >
+void BM_add_eq(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{}, b{};
+	a.rand_gen(gen);
+	b.rand_gen(gen);
+	for (auto _ : state) {
+		a += b;
+		benchmark::DoNotOptimize(a);
+		benchmark::ClobberMemory();
+	}
+}
+
+template< typename Tree >
+void BM_rand_gen(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{};
+	for (auto _ : state) {
+		a.rand_gen(gen);
+		benchmark::DoNotOptimize(a);
+	}
+}
+
+template< typename Tree >
+void BM_print(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{};
+	a.rand_gen(gen);
+	null_cout quiet;
+	for (auto _ : state) a.print("a");
+}
+
+template< typename Tree >
+void BM_format_to(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{};
+	a.rand_gen(gen);
+	std::string buffer;
+	for (auto _ : state) {
+		buffer.clear();
+		a.format_to(std::back_inserter(buffer), "a");
+		benchmark::DoNotOptimize(buffer.data());
+	}
+}
+
+template< typename Tree >
+void BM_tree_sum(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{};
+	a.rand_gen(gen);
+	for (auto _ : state) benchmark::DoNotOptimize(tree_sum(a));
+}
+
+// the same operations as type erased table scans
+template< typename Tree >
+void BM_table_add_eq(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{}, b{};
+	a.rand_gen(gen);
+	b.rand_gen(gen);
+	for (auto _ : state) {
+		table_add_eq(a, b);
+		benchmark::DoNotOptimize(a);
+		benchmark::ClobberMemory();
+	}
+}
+
+template< typename Tree >
+void BM_table_rand_gen(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{};
+	for (auto _ : state) {
+		table_rand_gen(a, gen);
+		benchmark::DoNotOptimize(a);
+	}
+}
+
+template< typename Tree >
+void BM_table_sum(benchmark::State& state)
+{
+	std::mt19937 gen{ 42 };
+	Tree a{};
+	a.rand_gen(gen);
+	for (auto _ : state) benchmark::DoNotOptimize(table_sum(a));
+}
+
+BENCHMARK_TEMPLATE(BM_add_eq, BarPlain);
+BENCHMARK_TEMPLATE(BM_add_eq, Bar);
+BENCHMARK_TEMPLATE(BM_add_eq, Wide);
+BENCHMARK_TEMPLATE(BM_add_eq, Deep);
+BENCHMARK_TEMPLATE(BM_add_eq, Square);
+
+BENCHMARK_TEMPLATE(BM_rand_gen, BarPlain);
+BENCHMARK_TEMPLATE(BM_rand_gen, Bar);
+BENCHMARK_TEMPLATE(BM_rand_gen, Wide);
+
+BENCHMARK_TEMPLATE(BM_print, BarPlain);
+BENCHMARK_TEMPLATE(BM_print, Bar);
+BENCHMARK_TEMPLATE(BM_format_to, Bar);
+BENCHMARK_TEMPLATE(BM_format_to, Wide);
+
+BENCHMARK_TEMPLATE(BM_tree_sum, Bar);
+BENCHMARK_TEMPLATE(BM_tree_sum, Wide);
+
+BENCHMARK_TEMPLATE(BM_table_add_eq, Bar);
+BENCHMARK_TEMPLATE(BM_table_add_eq, Wide);
+BENCHMARK_TEMPLATE(BM_table_add_eq, Deep);
+BENCHMARK_TEMPLATE(BM_table_rand_gen, Bar);
+BENCHMARK_TEMPLATE(BM_table_rand_gen, Wide);
+BENCHMARK_TEMPLATE(BM_table_sum, Bar);
+BENCHMARK_TEMPLATE(BM_table_sum, Wide);
+
+// ******************************************************************
+// BATCH, SOA AND PARALLEL PATHS
+// ******************************************************************
+
+template< typename Tree >
+void BM_add_eq_aos_loop(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	std::vector<Tree> a(n), b(n);
+	for (auto _ : state) {
+		for (std::size_t i = 0; i < n; ++i) a[i] += b[i];
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+template< typename Tree >
+void BM_tree_add_eq_soa(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	TreeSoA<Tree> a, b;
+	a.resize(n);
+	b.resize(n);
+	for (auto _ : state) {
+		a += b;
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+template< typename Tree >
+void BM_batch_rand_gen(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	TreeSoA<Tree> a;
+	a.resize(n);
+	for (auto _ : state) {
+		batch_rand_gen(a, 42);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+template< typename Tree >
+void BM_batch_rand_gen_par(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	TreeSoA<Tree> a;
+	a.resize(n);
+	for (auto _ : state) {
+		batch_rand_gen(par_scan, a, 42);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+template< typename Tree >
+void BM_batch_sum(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	TreeSoA<Tree> a;
+	a.resize(n);
+	batch_rand_gen(a, 42);
+	for (auto _ : state) benchmark::DoNotOptimize(batch_sum(a));
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+template< typename Tree >
+void BM_batch_sum_par(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	TreeSoA<Tree> a;
+	a.resize(n);
+	batch_rand_gen(a, 42);
+	for (auto _ : state) benchmark::DoNotOptimize(batch_sum(par_scan, a));
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+// leaf functors of a clamp, scale, sum chain
+struct bench_clamp_f
+{
+	template< typename Leaf, typename... Params >
+	static void apply(Leaf& l, std::size_t, Params&...) { if (l.val > 150) l.val = 150; }
+};
+
+struct bench_scale_f
+{
+	template< typename Leaf, typename... Params >
+	static void apply(Leaf& l, std::size_t, Params&...) { l.val = l.val * 0.5 + 1; }
+};
+
+struct bench_sum_f
+{
+	template< typename Leaf >
+	static void apply(Leaf& l, std::size_t, double& sum) { sum += l.val; }
+};
+
+// one inher_tree_for_each pass over the whole batch per functor
+template< typename Tree >
+void BM_scan_passes(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	std::vector<Tree> a(n);
+	for (auto _ : state) {
+		double sum = 0;
+		for (Tree& t : a) inher_tree_for_each< bench_clamp_f, all_leaves >(t, sum);
+		for (Tree& t : a) inher_tree_for_each< bench_scale_f, all_leaves >(t, sum);
+		for (Tree& t : a) inher_tree_for_each< bench_sum_f, all_leaves >(t, sum);
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+// the same chain fused by a scan_plan, a single pass over the batch
+template< typename Tree >
+void BM_scan_plan(benchmark::State& state)
+{
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	std::vector<Tree> a(n);
+	for (auto _ : state) {
+		double sum = 0;
+		for (Tree& t : a) scan_plan< bench_clamp_f, bench_scale_f, bench_sum_f >::run(t, sum);
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+BENCHMARK_TEMPLATE(BM_add_eq_aos_loop, BarPlain)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_add_eq_aos_loop, Bar)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_tree_add_eq_soa, Bar)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_tree_add_eq_soa, Square)->Range(1 << 10, 1 << 16);
+
+BENCHMARK_TEMPLATE(BM_batch_rand_gen, Bar)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_batch_rand_gen_par, Bar)->Range(1 << 10, 1 << 20)->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_batch_sum, Bar)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_batch_sum_par, Bar)->Range(1 << 10, 1 << 20)->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_scan_passes, Square)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(BM_scan_plan, Square)->Range(1 << 8, 1 << 16);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Builds and runs the runtime benchmarks, extra arguments are passed on
+# to the benchmark binary (e.g. --benchmark_filter=add_eq).
+# ./runtime_bench.sh asm instead disassembles the rapid_asm_* hooks, to
+# check that tree operations inline down to the plain struct code.
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -march=native}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+$CXX $CXXFLAGS "$(dirname "$0")/runtime_bench.cpp" -o "$OUT/runtime_bench" \
+	-lbenchmark -lpthread || exit 1
+
+if [ "$1" = asm ]; then
+	for hook in $(nm "$OUT/runtime_bench" | awk '$3 ~ /^rapid_asm_/ { print $3 }' | sort); do
+		objdump -d --no-show-raw-insn --disassemble="$hook" "$OUT/runtime_bench" |
+			sed -n '/^[0-9a-f]* <'"$hook"'>:/,/^$/p'
+	done
+else
+	"$OUT/runtime_bench" "$@"
+fi
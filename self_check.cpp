@@ -0,0 +1,417 @@
+/*
+Behavior checks for the batch, offload and distributed tree operations.
+Copyright (C) 2023  Dustin Sanford
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+Instantiates every batch operation once for a tree holding a leaf of
+each kernel kind (bool, integral, floating and std::array leaves) and
+checks it against the plain row by row tree operations. Prints every
+failed check and exits non zero if there was one. Build once with and
+once without -DRAPID_FOLD_SCAN to cover both scan engines, see
+self_check.sh.
+*/
+
+#define RAPID_NO_MAIN
+#include "rapid_snippit.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int self_check_failures = 0;
+
+static void self_check_fail(const char* what, int line)
+{
+	std::printf("self_check.cpp:%d: check failed: %s\n", line, what);
+	++self_check_failures;
+}
+
+#define SELF_CHECK(...) ((__VA_ARGS__) ? (void)0 : self_check_fail(#__VA_ARGS__, __LINE__))
+
+// one leaf of every kernel kind, spread over three levels
+using CQ = LeafNode< mpl::string<'q'>, bool >;
+using CA = LeafNode< mpl::string<'A'>, int >;
+using CB = LeafNode< mpl::string<'B'>, float >;
+using CV = LeafNode< mpl::string<'V'>, std::array<float, 3> >;
+using CE = LeafNode< mpl::string<'E'>, long >;
+using CW = LeafNode< mpl::string<'W'>, std::array<int, 2> >;
+using CD = LeafNode< mpl::string<'D'>, double >;
+
+using Check = InternalNode<
+	mpl::string<'c','h','e','c','k'>,
+	CQ,
+	CA,
+	InternalNode<
+		mpl::string<'s','u','b'>,
+		CB,
+		CV,
+		InternalNode< mpl::string<'i','n'>, CE, CW >
+	>,
+	CD
+>;
+
+// the scan order indices of the leaves, which index sum_tree and mean_tree
+enum { IQ, IA, IB, IV, IE, IW, ID };
+
+constexpr std::uint64_t seed = 2023;
+
+// a batch of n random rows in which every other bool is set
+static TreeSoA<Check> random_batch(std::size_t n, std::uint64_t s)
+{
+	TreeSoA<Check> soa(n);
+	batch_rand_gen(soa, s);
+	for (std::size_t i = 0; i < n; ++i)
+		soa.column<CQ>()[i] = (i + s) % 2 == 0;
+	return soa;
+}
+
+// row i of a batch as a plain tree
+static Check row(const TreeSoA<Check>& s, std::size_t i)
+{
+	return s[i];
+}
+
+static bool same_rows(const TreeSoA<Check>& a, const TreeSoA<Check>& b)
+{
+	if (a.size() != b.size()) return false;
+	for (std::size_t i = 0; i < a.size(); ++i)
+		if (!tree_equal(a[i], b[i])) return false;
+	return true;
+}
+
+static bool close(double a, double b)
+{
+	return std::abs(a - b) <= 1e-9 * std::max(std::abs(a), std::abs(b)) + 1e-9;
+}
+
+template< typename F >
+static void run_ranks(int ranks, F f)
+{
+	local_transport_group group(ranks);
+	std::vector<std::thread> threads;
+	for (int r = 0; r < ranks; ++r)
+		threads.emplace_back([&group, &f, r] { local_transport t(group, r); f(t); });
+	for (auto& t : threads) t.join();
+}
+
+// TreeSoA +=, tree_add_eq and bool column resizing
+static void check_soa_add()
+{
+	const std::size_t n = 37;
+	TreeSoA<Check> a = random_batch(n, 1), b = random_batch(n, 2);
+	TreeSoA<Check> c = a;
+	c += b;
+	bool rows = true;
+	for (std::size_t i = 0; i < n; ++i) {
+		Check r = row(a, i);
+		r += row(b, i);
+		rows = rows && tree_equal(r, row(c, i));
+	}
+	SELF_CHECK(rows);
+
+	TreeSoA<Check> d = a;
+	tree_add_eq(d, b);
+	SELF_CHECK(same_rows(c, d));
+
+	TreeSoA<Check> short_batch(n - 1);
+	bool threw = false;
+	try { c += short_batch; }
+	catch (const std::invalid_argument&) { threw = true; }
+	SELF_CHECK(threw);
+
+	TreeSoA<Check> grown = a;
+	grown.resize(n + 5);
+	SELF_CHECK(grown.column<CQ>()[n - 1] == a.column<CQ>()[n - 1]);
+	SELF_CHECK(!grown.column<CQ>()[n + 4]);
+}
+
+// batch_rand_gen on a TreeSoA, in parallel and on an array of trees
+static void check_rand_gen()
+{
+	const std::size_t n = 1000;
+	TreeSoA<Check> s(n), p(n);
+	batch_rand_gen(s, seed);
+	batch_rand_gen(par_scan, p, seed);
+	std::vector<Check> trees(n);
+	batch_rand_gen(trees.data(), n, seed);
+
+	bool same = true, elements = false;
+	for (std::size_t i = 0; i < n; ++i) {
+		same = same && tree_equal(row(s, i), row(p, i)) && tree_equal(row(s, i), trees[i]);
+		elements = elements || s.column<CV>()[i][0] != s.column<CV>()[i][1];
+	}
+	SELF_CHECK(same);
+	SELF_CHECK(elements);
+
+	// a sub range is the same slice of the whole batch
+	TreeSoA<Check> part(n);
+	batch_rand_gen(part, seed, 100, 300);
+	bool slice = true;
+	for (std::size_t i = 100; i < 300; ++i)
+		slice = slice && tree_equal(row(part, i), row(s, i));
+	SELF_CHECK(slice);
+}
+
+// batch_sum and batch_mean against row by row sums
+static void check_batch_sum()
+{
+	const std::size_t n = 513;
+	TreeSoA<Check> s = random_batch(n, 3);
+
+	std::uint64_t q = 0;
+	std::int64_t ia = 0, ie = 0, iw = 0;
+	double b = 0, v = 0, d = 0;
+	for (std::size_t i = 0; i < n; ++i) {
+		q += s.column<CQ>()[i];
+		ia += s.column<CA>()[i];
+		ie += s.column<CE>()[i];
+		for (int e : s.column<CW>()[i]) iw += e;
+		b += s.column<CB>()[i];
+		for (float e : s.column<CV>()[i]) v += e;
+		d += s.column<CD>()[i];
+	}
+
+	const sum_tree<Check> sum = batch_sum(s);
+	SELF_CHECK(leaf_at<IQ>(sum).val == q);
+	SELF_CHECK(leaf_at<IA>(sum).val == ia);
+	SELF_CHECK(leaf_at<IE>(sum).val == ie);
+	SELF_CHECK(leaf_at<IW>(sum).val == iw);
+	SELF_CHECK(close(leaf_at<IB>(sum).val, b));
+	SELF_CHECK(close(leaf_at<IV>(sum).val, v));
+	SELF_CHECK(close(leaf_at<ID>(sum).val, d));
+	SELF_CHECK(tree_equal(batch_sum(par_scan, s), sum));
+
+	const mean_tree<Check> mean = batch_mean(s);
+	SELF_CHECK(close(leaf_at<IA>(mean).val, static_cast<double>(ia) / n));
+	SELF_CHECK(close(leaf_at<ID>(mean).val, d / n));
+	SELF_CHECK(tree_equal(batch_mean(par_scan, s), mean));
+}
+
+// the type erased table scans against the inlined scans
+static void check_table_ops()
+{
+	std::mt19937 g1(7), g2(7);
+	Check a, b;
+	a.rand_gen(g1);
+	b.rand_gen(g1);
+	Check ta, tb;
+	table_rand_gen(ta, g2);
+	table_rand_gen(tb, g2);
+	SELF_CHECK(tree_equal(a, ta));
+	SELF_CHECK(tree_equal(b, tb));
+
+	get<CQ>(b).val = true;
+	get<CQ>(tb).val = true;
+	a += b;
+	table_add_eq(ta, tb);
+	SELF_CHECK(tree_equal(a, ta));
+	SELF_CHECK(close(table_sum(ta), tree_sum(a)));
+}
+
+// serialization, hashing and a sparse copy of a single tree
+static void check_tree_ops()
+{
+	std::mt19937 g(11);
+	Check a;
+	a.rand_gen(g);
+	get<CQ>(a).val = true;
+
+	std::vector<unsigned char> bytes(tree_layout<Check>::size);
+	serialize(a, bytes.data());
+	Check b;
+	deserialize(b, bytes.data());
+	SELF_CHECK(tree_equal(a, b));
+	SELF_CHECK(tree_hash(a) == tree_hash(b));
+
+	SparseTree<Check> s;
+	s.set<IQ>(true);
+	s.set<IV>(get<CV>(a).val);
+	s.set<ID>(get<CD>(a).val);
+	SELF_CHECK(s.size() == 3);
+	SELF_CHECK(s.find<IQ>()->val && s.find<IV>()->val == get<CV>(a).val);
+	SELF_CHECK(s.find<ID>()->val == get<CD>(a).val && s.find<IA>() == nullptr);
+	s.erase<IQ>();
+	SELF_CHECK(s.find<IV>()->val == get<CV>(a).val && s.find<ID>()->val == get<CD>(a).val);
+}
+
+// atomic accumulation into one shared tree, which takes arithmetic leaves only
+using Counters = InternalNode< mpl::string<'c','n','t'>, CQ, CA, CE, CD >;
+
+static void check_atomic_add()
+{
+	Counters shared{}, one{};
+	get<CA>(one).val = 1;
+	get<CE>(one).val = 2;
+	get<CD>(one).val = 0.5;
+	Counters flag = one;
+	get<CQ>(flag).val = true;
+
+	const int threads = 4, adds = 1000;
+	std::vector<std::thread> pool;
+	for (int t = 0; t < threads; ++t)
+		pool.emplace_back([&, t] {
+			for (int k = 0; k < adds; ++k)
+				atomic_tree_add(shared, t == 1 && k == adds / 2 ? flag : one);
+		});
+	for (auto& t : pool) t.join();
+
+	SELF_CHECK(get<CQ>(shared).val);
+	SELF_CHECK(get<CA>(shared).val == threads * adds);
+	SELF_CHECK(get<CE>(shared).val == 2 * threads * adds);
+	SELF_CHECK(get<CD>(shared).val == 0.5 * threads * adds);
+}
+
+// upload, +=, rand_gen, sum and download through the host backend
+static void check_device()
+{
+	const std::size_t n = 300;
+	TreeSoA<Check> a = random_batch(n, 4), b = random_batch(n, 5);
+	TreeSoA<Check> expected = a;
+	expected += b;
+
+	host_stream s0, s1;
+	TreeSoA<Check> back(n);
+	{
+		TreeDevice<Check> da(n, s0), db(n, s1);
+		da.upload(a);
+		db.upload(b);
+		da += db;
+		const sum_tree<Check> sum = da.sum();
+		SELF_CHECK(tree_equal(sum, batch_sum(expected)));
+		da.download(back);
+		da.synchronize();
+	}
+	SELF_CHECK(same_rows(back, expected));
+
+	// random rows generated in chunks on the device match batch_rand_gen
+	TreeSoA<Check> host(n), ref(n);
+	batch_rand_gen(ref, seed);
+	offload_chunks(host, 77, [](TreeDevice<Check>& d, std::size_t first) {
+		d.rand_gen(seed, first);
+	}, false, true);
+	SELF_CHECK(same_rows(host, ref));
+
+	bool threw = false;
+	{
+		TreeDevice<Check> d(n, s0);
+		try { d.upload(a, n - 1, 2); }
+		catch (const std::out_of_range&) { threw = true; }
+	}
+	SELF_CHECK(threw);
+}
+
+// allreduce of trees and of batches between threads of one process
+static void check_allreduce()
+{
+	const int ranks = 3;
+	const std::size_t n = 50;
+
+	TreeSoA<Check> total = random_batch(n, 10);
+	Check tree_total = row(total, 0);
+	for (int r = 1; r < ranks; ++r) {
+		total += random_batch(n, 10 + r);
+		Check t = row(random_batch(n, 10 + r), 0);
+		tree_total += t;
+	}
+
+	std::atomic<int> batches{ 0 }, trees{ 0 }, mismatches{ 0 };
+	run_ranks(ranks, [&](local_transport& t) {
+		TreeSoA<Check> batch = random_batch(n, 10 + t.rank());
+		Check tree = row(batch, 0);
+		allreduce(batch, t);
+		allreduce(tree, t);
+		batches += same_rows(batch, total);
+		trees += tree_equal(tree, tree_total);
+
+		TreeSoA<Check> uneven(t.rank() == 1 ? n + 1 : n);
+		try { allreduce(uneven, t); }
+		catch (const std::invalid_argument&) { ++mismatches; }
+	});
+	SELF_CHECK(batches == ranks);
+	SELF_CHECK(trees == ranks);
+	SELF_CHECK(mismatches == ranks);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// a written soa file read back through its mapped view
+static void check_soa_file(const std::string& filename)
+{
+	TreeSoA<Check> a = random_batch(129, 6);
+	write_soa_file(a, filename);
+	{
+		mapped_soa_file<Check> file(filename);
+		TreeSoAView<Check> view = file.view();
+		SELF_CHECK(view.size() == a.size());
+		bool rows = view.size() == a.size();
+		for (std::size_t i = 0; rows && i < a.size(); ++i)
+			rows = tree_equal(view[i], row(a, i)) && view.column<CQ>()[i] == a.column<CQ>()[i];
+		SELF_CHECK(rows);
+	}
+	std::remove(filename.c_str());
+}
+#endif
+
+// counts the leaves it visits, except for the bool leaf
+struct count_f
+{
+	static void apply(const CQ&, std::size_t, int&) {}
+	template< typename Leaf >
+	static void apply(const Leaf&, std::size_t, int& n) { ++n; }
+};
+
+// filters and the compile time lookups
+static void check_filters()
+{
+	Check a{};
+	int root = 0, sub = 0;
+	inher_tree_for_each< count_f, under_name< mpl::string<'c','h','e','c','k'> > >(a, root);
+	inher_tree_for_each< count_f, under_name< mpl::string<'s','u','b'> > >(a, sub);
+	SELF_CHECK(root == 6);
+	SELF_CHECK(sub == 4);
+
+	static_assert(leaf_index< Check, mpl::string<'s','u','b'>, mpl::string<'i','n'>,
+		mpl::string<'W'> >::value == IW, "leaf_index of W");
+}
+
+// usage: self_check [scratch soa file]
+int main(int argc, char** argv)
+{
+	check_soa_add();
+	check_rand_gen();
+	check_batch_sum();
+	check_table_ops();
+	check_tree_ops();
+	check_atomic_add();
+	check_device();
+	check_allreduce();
+	check_filters();
+#if defined(__unix__) || defined(__APPLE__)
+	check_soa_file(argc > 1 ? argv[1] : "self_check.soa");
+#else
+	(void)argc;
+	(void)argv;
+#endif
+
+	if (self_check_failures)
+		std::printf("%d checks failed\n", self_check_failures);
+	else
+		std::printf("all checks passed\n");
+	return self_check_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Builds and runs the behavior checks of self_check.cpp once for each scan
+# engine, with the address and undefined behavior sanitizers by default.
+# usage: ./self_check.sh
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O1 -g -fsanitize=address,undefined}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+for engine in recur fold; do
+	flags=""
+	[ "$engine" = fold ] && flags="-DRAPID_FOLD_SCAN"
+	$CXX $CXXFLAGS $flags "$(dirname "$0")/self_check.cpp" -o "$OUT/$engine" -lpthread || exit 1
+	printf "%-8s " "$engine"
+	"$OUT/$engine" "$OUT/$engine.soa" || exit 1
+done